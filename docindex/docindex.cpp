@@ -0,0 +1,728 @@
+#include "docindex.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+/*需要关注的目录事件*/
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+/*事件停止到达多久后发布新快照，以及连续有事件时最多延迟多久发布(毫秒)*/
+static const int PUBLISH_QUIET_MS = 20;
+static const long PUBLISH_MAX_DELAY_MS = 200;
+
+/*共享内存快照的格式：[snapshot_header][doc_root][snapshot_record + 路径 ...]，每一部分按8字节对齐*/
+static const char SNAPSHOT_MAGIC[8] = "DOCIDX";
+static const uint32_t SNAPSHOT_VERSION = 1;
+/*记录是指向目录的符号链接*/
+static const uint32_t SNAPSHOT_SYMLINK_DIR = 1;
+/*快照保存时可能还有尚未读取的inotify事件，修改时间在快照之前这么多秒以内的目录也重新读取*/
+static const time_t SNAPSHOT_SLACK_SEC = 1;
+
+struct snapshot_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    /*快照的保存时间(CLOCK_REALTIME)以及整个快照的大小*/
+    int64_t created;
+    uint64_t size;
+    uint32_t root_len;
+    uint32_t reserved;
+};
+
+struct snapshot_record{
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    uint32_t mode;
+    uint16_t flags;
+    uint16_t path_len;
+};
+
+static size_t align8(size_t len){
+    return (len + 7) & ~(size_t)7;
+}
+
+static long now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*索引中的键：doc_root本身为"/"，其余为"/a/b"*/
+static std::string key_of(const std::string& rel){
+    return rel.empty() ? std::string("/") : rel;
+}
+
+docindex::docindex():
+m_inotify_fd(-1), m_stop_fd(-1), m_running(false), m_incomplete(false), m_need_rebuild(false),
+m_snapshot(NULL), m_epoch(0){
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        m_dirty[i] = false;
+    }
+    m_readers[0].count = 0;
+    m_readers[1].count = 0;
+}
+
+docindex::~docindex(){
+    close();
+}
+
+uint64_t docindex::hash(const char* data, size_t len){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i ++){
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool docindex::open(const char* doc_root, const char* snapshot){
+    if(m_running){
+        return false;
+    }
+    m_root = doc_root;
+    while(m_root.size() > 1 && m_root[m_root.size() - 1] == '/'){
+        m_root.erase(m_root.size() - 1);
+    }
+    /*只有doc_root本身无法访问时才失败*/
+    struct stat st;
+    if(stat(m_root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)){
+        fprintf(stderr, "docindex: %s is not an accessible directory\n", m_root.c_str());
+        return false;
+    }
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_inotify_fd < 0 || m_stop_fd < 0){
+        close();
+        return false;
+    }
+    if((!snapshot || !load_snapshot(snapshot)) && !rebuild()){
+        close();
+        return false;
+    }
+    if(m_incomplete){
+        fprintf(stderr, "docindex: index of %s is incomplete, lookups of unindexed paths fall back to stat()\n",
+                m_root.c_str());
+    }
+    publish();
+    if(pthread_create(&m_thread, NULL, worker, this) != 0){
+        close();
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void docindex::close(){
+    if(m_running){
+        uint64_t one = 1;
+        ::write(m_stop_fd, &one, sizeof(one));
+        pthread_join(m_thread, NULL);
+        m_running = false;
+    }
+    if(m_inotify_fd >= 0){
+        ::close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+    if(m_stop_fd >= 0){
+        ::close(m_stop_fd);
+        m_stop_fd = -1;
+    }
+    snapshot* snap = m_snapshot.exchange(NULL);
+    if(snap){
+        synchronize();
+        for(int i = 0; i < SHARD_COUNT; i ++){
+            delete snap->shards[i];
+        }
+        delete snap;
+    }
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        m_master[i].clear();
+    }
+    m_wd_paths.clear();
+    m_path_wds.clear();
+    m_symlink_dirs.clear();
+}
+
+docindex::LOOKUP_RESULT docindex::lookup(const char* path, size_t len, docindex_entry* entry){
+    if(len == 0 || path[0] != '/'){
+        return UNKNOWN;
+    }
+    /*去掉末尾的'/'；含有"//"、"."或".."的路径交给文件系统处理*/
+    while(len > 1 && path[len - 1] == '/'){
+        len --;
+    }
+    for(size_t i = 0; i < len; i ++){
+        if(path[i] != '/'){
+            continue;
+        }
+        size_t seg = i + 1;
+        if(seg == len){
+            break;
+        }
+        if(path[seg] == '/' ||
+           (path[seg] == '.' && (seg + 1 == len || path[seg + 1] == '/' ||
+                                 (path[seg + 1] == '.' && (seg + 2 == len || path[seg + 2] == '/'))))){
+            return UNKNOWN;
+        }
+    }
+
+    uint64_t h = hash(path, len);
+    /*进入读侧临界区：登记到当前纪元对应的计数器上*/
+    unsigned idx = m_epoch.load() & 1;
+    m_readers[idx].count.fetch_add(1);
+    LOOKUP_RESULT ret = UNKNOWN;
+    snapshot* snap = m_snapshot.load();
+    if(snap){
+        ret = snap->authoritative ? NOT_FOUND : UNKNOWN;
+        const shard* sh = snap->shards[h & (SHARD_COUNT - 1)];
+        uint32_t mask = sh->buckets.size() - 1;
+        uint32_t slot = (h >> 6) & mask;
+        for(uint32_t i = 0; i <= mask; i ++){
+            uint32_t index = sh->buckets[slot];
+            if(index == 0){
+                break;
+            }
+            const item& it = sh->items[index - 1];
+            if(it.hash == h && it.path.size() == len && memcmp(it.path.data(), path, len) == 0){
+                *entry = it.entry;
+                ret = FOUND;
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+    m_readers[idx].count.fetch_sub(1);
+    return ret;
+}
+
+/*翻转两次纪元并分别等待对应计数器归零，之后不会再有读者引用旧快照*/
+void docindex::synchronize(){
+    for(int round = 0; round < 2; round ++){
+        unsigned old = m_epoch.fetch_add(1) & 1;
+        while(m_readers[old].count.load() != 0){
+            sched_yield();
+        }
+    }
+}
+
+docindex::shard* docindex::build_shard(const shard_map& map){
+    shard* sh = new shard;
+    uint32_t bucket_count = 8;
+    while(bucket_count < map.size() * 2){
+        bucket_count <<= 1;
+    }
+    sh->items.reserve(map.size());
+    sh->buckets.assign(bucket_count, 0);
+    for(shard_map::const_iterator it = map.begin(); it != map.end(); ++ it){
+        item one;
+        one.hash = hash(it->first.data(), it->first.size());
+        one.path = it->first;
+        one.entry = it->second;
+        sh->items.push_back(one);
+        uint32_t slot = (one.hash >> 6) & (bucket_count - 1);
+        while(sh->buckets[slot] != 0){
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        sh->buckets[slot] = sh->items.size();
+    }
+    return sh;
+}
+
+/*只重建被修改过的分片，其余分片与旧快照共享*/
+void docindex::publish(){
+    snapshot* old = m_snapshot.load();
+    snapshot* snap = new snapshot;
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        if(!old || m_dirty[i]){
+            snap->shards[i] = build_shard(m_master[i]);
+        }
+        else{
+            snap->shards[i] = old->shards[i];
+        }
+        m_dirty[i] = false;
+    }
+    snap->authoritative = m_symlink_dirs.empty() && !m_incomplete;
+    m_snapshot.store(snap);
+    if(old){
+        synchronize();
+        for(int i = 0; i < SHARD_COUNT; i ++){
+            if(old->shards[i] != snap->shards[i]){
+                delete old->shards[i];
+            }
+        }
+        delete old;
+    }
+}
+
+void docindex::insert(const std::string& rel, const struct stat& st){
+    std::string key = key_of(rel);
+    int index = hash(key.data(), key.size()) & (SHARD_COUNT - 1);
+    docindex_entry& entry = m_master[index][key];
+    entry.ino = st.st_ino;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.mode = st.st_mode;
+    m_dirty[index] = true;
+}
+
+/*删除rel及其下所有路径，同时移除其中目录的监视*/
+void docindex::remove_subtree(const std::string& rel){
+    std::string key = key_of(rel);
+    std::string prefix = key + "/";
+    int index = hash(key.data(), key.size()) & (SHARD_COUNT - 1);
+    if(m_master[index].erase(key)){
+        m_dirty[index] = true;
+    }
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        shard_map::iterator it = m_master[i].lower_bound(prefix);
+        while(it != m_master[i].end() && it->first.compare(0, prefix.size(), prefix) == 0){
+            m_master[i].erase(it ++);
+            m_dirty[i] = true;
+        }
+    }
+    std::map< std::string, int >::iterator wd = m_path_wds.lower_bound(rel);
+    while(wd != m_path_wds.end() &&
+          (wd->first == rel || wd->first.compare(0, prefix.size(), prefix) == 0)){
+        inotify_rm_watch(m_inotify_fd, wd->second);
+        m_wd_paths.erase(wd->second);
+        m_path_wds.erase(wd ++);
+    }
+    std::set< std::string >::iterator link = m_symlink_dirs.lower_bound(rel);
+    while(link != m_symlink_dirs.end() &&
+          (*link == rel || link->compare(0, prefix.size(), prefix) == 0)){
+        m_symlink_dirs.erase(link ++);
+    }
+}
+
+bool docindex::add_watch(const std::string& rel){
+    int wd = inotify_add_watch(m_inotify_fd, (m_root + rel).c_str(), WATCH_MASK);
+    if(wd < 0){
+        fprintf(stderr, "docindex: cannot watch %s: %s\n", (m_root + rel).c_str(), strerror(errno));
+        return false;
+    }
+    m_wd_paths[wd] = rel;
+    m_path_wds[rel] = wd;
+    return true;
+}
+
+/*先添加监视再读取目录，读取期间发生的变化会以事件的形式到达*/
+bool docindex::scan(const std::string& rel){
+    if(!add_watch(rel)){
+        return false;
+    }
+    DIR* dir = opendir((m_root + rel).c_str());
+    if(!dir){
+        return errno == ENOENT;
+    }
+    bool ok = true;
+    struct dirent* ent;
+    while(ok && (ent = readdir(dir)) != NULL){
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+            continue;
+        }
+        std::string child = rel + "/" + ent->d_name;
+        std::string real_path = m_root + child;
+        struct stat lst, st;
+        if(lstat(real_path.c_str(), &lst) < 0 || stat(real_path.c_str(), &st) < 0){
+            continue;
+        }
+        insert(child, st);
+        if(S_ISDIR(st.st_mode)){
+            if(S_ISLNK(lst.st_mode)){
+                m_symlink_dirs.insert(child);
+            }
+            else{
+                ok = scan(child);
+            }
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+bool docindex::rebuild(){
+    for(std::map< int, std::string >::iterator it = m_wd_paths.begin(); it != m_wd_paths.end(); ++ it){
+        inotify_rm_watch(m_inotify_fd, it->first);
+    }
+    m_wd_paths.clear();
+    m_path_wds.clear();
+    m_symlink_dirs.clear();
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        m_master[i].clear();
+        m_dirty[i] = true;
+    }
+    m_need_rebuild = false;
+    struct stat st;
+    if(stat(m_root.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)){
+        m_incomplete = true;
+        return false;
+    }
+    insert("", st);
+    /*无法监视全部目录时(如达到max_user_watches)仍然发布索引，它不是权威的，查不到的路径退回stat*/
+    m_incomplete = !scan("");
+    return true;
+}
+
+/*根据文件系统的当前状态更新rel*/
+void docindex::refresh(const std::string& rel){
+    std::string real_path = m_root + rel;
+    struct stat lst, st;
+    if(lstat(real_path.c_str(), &lst) < 0 || stat(real_path.c_str(), &st) < 0){
+        remove_subtree(rel);
+        return;
+    }
+    bool was_dir = m_path_wds.count(rel) || m_symlink_dirs.count(rel);
+    if(S_ISDIR(st.st_mode)){
+        if(S_ISLNK(lst.st_mode)){
+            remove_subtree(rel);
+            insert(rel, st);
+            m_symlink_dirs.insert(rel);
+        }
+        else if(!was_dir){
+            remove_subtree(rel);
+            insert(rel, st);
+            if(!scan(rel)){
+                m_incomplete = true;
+            }
+        }
+        else{
+            insert(rel, st);
+        }
+    }
+    else{
+        if(was_dir){
+            remove_subtree(rel);
+        }
+        insert(rel, st);
+    }
+}
+
+void docindex::handle_events(const char* buf, ssize_t len){
+    for(const char* ptr = buf; ptr < buf + len; ){
+        const struct inotify_event* event = (const struct inotify_event*)ptr;
+        ptr += sizeof(struct inotify_event) + event->len;
+        if(event->mask & IN_Q_OVERFLOW){
+            m_need_rebuild = true;
+            continue;
+        }
+        std::map< int, std::string >::iterator it = m_wd_paths.find(event->wd);
+        if(it == m_wd_paths.end()){
+            continue;
+        }
+        /*目录已被删除，内核自动移除了监视*/
+        if(event->mask & IN_IGNORED){
+            m_path_wds.erase(it->second);
+            m_wd_paths.erase(it);
+            continue;
+        }
+        /*目录自身的事件由其父目录的事件处理*/
+        if(event->len == 0){
+            continue;
+        }
+        refresh(it->second + "/" + event->name);
+    }
+}
+
+void* docindex::worker(void* arg){
+    docindex* index = (docindex*)arg;
+    index->run();
+    return index;
+}
+
+/*inotify线程：批量读取事件，在事件暂停或者累积一段时间后发布一次新快照*/
+void docindex::run(){
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = m_inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_stop_fd;
+    fds[1].events = POLLIN;
+    bool pending = false;
+    long first_pending = 0;
+    while(true){
+        int timeout = -1;
+        if(pending){
+            long left = first_pending + PUBLISH_MAX_DELAY_MS - now_ms();
+            timeout = left < PUBLISH_QUIET_MS ? (left > 0 ? left : 0) : PUBLISH_QUIET_MS;
+        }
+        int ret = poll(fds, 2, timeout);
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        if(fds[1].revents & POLLIN){
+            break;
+        }
+        if(fds[0].revents & POLLIN){
+            ssize_t len;
+            m_writer_lock.lock();
+            while((len = ::read(m_inotify_fd, buf, sizeof(buf))) > 0){
+                handle_events(buf, len);
+            }
+            m_writer_lock.unlock();
+            if(!pending){
+                pending = true;
+                first_pending = now_ms();
+            }
+        }
+        if(pending && (ret == 0 || now_ms() - first_pending >= PUBLISH_MAX_DELAY_MS)){
+            m_writer_lock.lock();
+            if(m_need_rebuild){
+                rebuild();
+            }
+            publish();
+            m_writer_lock.unlock();
+            pending = false;
+        }
+    }
+}
+
+bool docindex::save_snapshot(const char* name){
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.created = time(NULL);
+
+    std::string image(sizeof(header), '\0');
+    m_writer_lock.lock();
+    /*索引不完整时新进程无论如何都要完整遍历*/
+    bool complete = !m_incomplete && !m_need_rebuild;
+    header.root_len = m_root.size();
+    image.append(m_root);
+    image.resize(align8(image.size()), '\0');
+    for(int i = 0; complete && i < SHARD_COUNT; i ++){
+        for(shard_map::const_iterator it = m_master[i].begin(); it != m_master[i].end(); ++ it){
+            snapshot_record rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.ino = it->second.ino;
+            rec.size = it->second.size;
+            rec.mtime = it->second.mtime;
+            rec.mode = it->second.mode;
+            rec.flags = m_symlink_dirs.count(it->first) ? SNAPSHOT_SYMLINK_DIR : 0;
+            rec.path_len = it->first.size();
+            image.append((const char*)&rec, sizeof(rec));
+            image.append(it->first);
+            image.resize(align8(image.size()), '\0');
+            header.count ++;
+        }
+    }
+    m_writer_lock.unlock();
+    if(!complete){
+        fprintf(stderr, "docindex: index is incomplete, not saving snapshot\n");
+        return false;
+    }
+    header.size = image.size();
+    memcpy(&image[0], &header, sizeof(header));
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    if(fd < 0){
+        fprintf(stderr, "docindex: cannot create snapshot %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    size_t written = 0;
+    while(written < image.size()){
+        ssize_t ret = ::write(fd, image.data() + written, image.size() - written);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            fprintf(stderr, "docindex: cannot write snapshot %s: %s\n", name, strerror(errno));
+            ::close(fd);
+            shm_unlink(name);
+            return false;
+        }
+        written += ret;
+    }
+    ::close(fd);
+    return true;
+}
+
+/*快照中的文件元数据直接使用；目录逐个重新添加监视，只有在快照之后被修改过(mtime/ctime更新)的目录才重新读取。
+  文件内容被原地修改时目录不变，这类变化要等到下一次inotify事件，在此之前resolve映射文件前的fstat保证不会越界*/
+bool docindex::load_snapshot(const char* name){
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if(fd < 0){
+        fprintf(stderr, "docindex: cannot open snapshot %s: %s\n", name, strerror(errno));
+        return false;
+    }
+    /*快照只使用一次*/
+    shm_unlink(name);
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_header)){
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    char* base = (char*)mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(base == MAP_FAILED){
+        return false;
+    }
+    snapshot_header header;
+    memcpy(&header, base, sizeof(header));
+    size_t offset = sizeof(header);
+    if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+       header.size != size || header.root_len > size - offset ||
+       m_root.compare(0, std::string::npos, base + offset, header.root_len) != 0){
+        fprintf(stderr, "docindex: snapshot %s does not match %s\n", name, m_root.c_str());
+        munmap(base, size);
+        return false;
+    }
+    offset = align8(offset + header.root_len);
+
+    for(int i = 0; i < SHARD_COUNT; i ++){
+        m_master[i].clear();
+        m_dirty[i] = true;
+    }
+    m_symlink_dirs.clear();
+    m_need_rebuild = false;
+    /*目录列表以及快照中每个目录的子项*/
+    std::vector< std::string > dirs;
+    std::map< std::string, std::vector< std::string > > children;
+    bool valid = true;
+    for(uint32_t n = 0; n < header.count; n ++){
+        snapshot_record rec;
+        if(offset + sizeof(rec) > size){
+            valid = false;
+            break;
+        }
+        memcpy(&rec, base + offset, sizeof(rec));
+        offset += sizeof(rec);
+        if(rec.path_len == 0 || rec.path_len > size - offset || base[offset] != '/'){
+            valid = false;
+            break;
+        }
+        std::string key(base + offset, rec.path_len);
+        offset = align8(offset + rec.path_len);
+        docindex_entry& entry = m_master[hash(key.data(), key.size()) & (SHARD_COUNT - 1)][key];
+        entry.ino = rec.ino;
+        entry.size = rec.size;
+        entry.mtime = rec.mtime;
+        entry.mode = rec.mode;
+        std::string rel = key == "/" ? std::string() : key;
+        if(rec.flags & SNAPSHOT_SYMLINK_DIR){
+            m_symlink_dirs.insert(rel);
+        }
+        else if(S_ISDIR(rec.mode)){
+            dirs.push_back(rel);
+        }
+        if(!rel.empty()){
+            children[rel.substr(0, rel.rfind('/'))].push_back(rel);
+        }
+    }
+    munmap(base, size);
+    /*按路径排序后父目录总在子目录之前*/
+    std::sort(dirs.begin(), dirs.end());
+    if(!valid || dirs.empty() || !dirs[0].empty()){
+        fprintf(stderr, "docindex: snapshot %s is corrupted\n", name);
+        return false;
+    }
+
+    time_t threshold = header.created - SNAPSHOT_SLACK_SEC;
+    m_incomplete = false;
+    for(size_t i = 0; i < dirs.size(); i ++){
+        const std::string& rel = dirs[i];
+        std::string key = key_of(rel);
+        shard_map& map = m_master[hash(key.data(), key.size()) & (SHARD_COUNT - 1)];
+        shard_map::iterator it = map.find(key);
+        /*已经被删除，或者已经作为新目录完整遍历过*/
+        if(it == map.end() || m_path_wds.count(rel)){
+            continue;
+        }
+        ino_t ino = it->second.ino;
+        /*先添加监视再检查目录，之后的变化都会以事件的形式到达*/
+        if(!add_watch(rel)){
+            /*目录已经不存在时删除它；否则refresh会重新遍历，仍然无法监视时索引被标记为不完整*/
+            refresh(rel);
+            continue;
+        }
+        struct stat st;
+        if(stat((m_root + rel).c_str(), &st) < 0 || !S_ISDIR(st.st_mode)){
+            refresh(rel);
+            continue;
+        }
+        if(st.st_ino != ino){
+            /*被替换成了另一个目录*/
+            remove_subtree(rel);
+            insert(rel, st);
+            if(!scan(rel)){
+                m_incomplete = true;
+            }
+            continue;
+        }
+        if(st.st_mtime >= threshold || st.st_ctime >= threshold){
+            if(!rescan(rel, children[rel])){
+                m_incomplete = true;
+            }
+        }
+        insert(rel, st);
+    }
+    return true;
+}
+
+bool docindex::rescan(const std::string& rel, const std::vector< std::string >& children){
+    DIR* dir = opendir((m_root + rel).c_str());
+    if(!dir){
+        return errno == ENOENT;
+    }
+    bool ok = true;
+    std::set< std::string > seen;
+    struct dirent* ent;
+    while(ok && (ent = readdir(dir)) != NULL){
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+            continue;
+        }
+        std::string child = rel + "/" + ent->d_name;
+        std::string real_path = m_root + child;
+        struct stat lst, st;
+        if(lstat(real_path.c_str(), &lst) < 0 || stat(real_path.c_str(), &st) < 0){
+            continue;
+        }
+        seen.insert(child);
+        shard_map& map = m_master[hash(child.data(), child.size()) & (SHARD_COUNT - 1)];
+        shard_map::iterator it = map.find(child);
+        bool was_link = m_symlink_dirs.count(child);
+        bool was_dir = it != map.end() && S_ISDIR(it->second.mode) && !was_link;
+        if(S_ISDIR(st.st_mode) && !S_ISLNK(lst.st_mode)){
+            /*仍然是快照中的那个目录，留给load_snapshot的循环检查*/
+            if(was_dir && it->second.ino == st.st_ino){
+                continue;
+            }
+            remove_subtree(child);
+            insert(child, st);
+            ok = scan(child);
+        }
+        else{
+            if(was_dir || was_link){
+                remove_subtree(child);
+            }
+            insert(child, st);
+            if(S_ISDIR(st.st_mode)){
+                m_symlink_dirs.insert(child);
+            }
+        }
+    }
+    closedir(dir);
+    for(size_t i = 0; i < children.size(); i ++){
+        if(!seen.count(children[i])){
+            remove_subtree(children[i]);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,128 @@
+#ifndef DOCINDEX_H
+#define DOCINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "locker.h"
+
+/*索引中记录的文件元数据*/
+struct docindex_entry{
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    mode_t mode;
+};
+
+/*doc_root的内存元数据索引：启动时遍历doc_root建立 路径->(inode, 大小, 修改时间, 权限) 的索引，
+  之后由后台线程根据inotify事件增量更新。
+  读者无锁：索引以不可变快照的形式发布，写者替换快照后等待所有读者离开旧快照(类似RCU)再释放旧快照。
+  索引覆盖了doc_root下的全部路径，因此查找不到即可直接判定为404，不需要再访问文件系统*/
+class docindex{
+public:
+    /*查找结果：找到；确定不存在；索引无法判断(需要回退到stat)*/
+    enum LOOKUP_RESULT{ FOUND = 0, NOT_FOUND, UNKNOWN };
+    /*快照按路径哈希分片，一次更新只需要重建被修改的分片*/
+    static const int SHARD_COUNT = 64;
+
+public:
+    docindex();
+    ~docindex();
+    /*遍历doc_root建立索引并启动inotify线程，doc_root无法访问时返回false。
+      inotify监视数量达到上限时索引不完整，仍然返回true，索引中找不到的路径退回stat。
+      snapshot不为NULL时先加载旧进程用save_snapshot保存的快照(加载后删除)，
+      只重新读取快照之后修改过的目录，其余目录只需重新添加监视；快照无效时退回完整遍历*/
+    bool open(const char* doc_root, const char* snapshot = NULL);
+    /*停止inotify线程并释放索引*/
+    void close();
+    /*查找path(以'/'开头，相对于doc_root，不需要以'\0'结尾)，可被任意线程并发调用*/
+    LOOKUP_RESULT lookup(const char* path, size_t len, docindex_entry* entry);
+    /*把当前索引保存到名为name的POSIX共享内存中，供平滑重启后的新进程加载，可与inotify线程并发调用*/
+    bool save_snapshot(const char* name);
+
+private:
+    /*快照中的一条记录*/
+    struct item{
+        uint64_t hash;
+        std::string path;
+        docindex_entry entry;
+    };
+    /*不可变分片，开放寻址哈希表*/
+    struct shard{
+        std::vector< item > items;
+        std::vector< uint32_t > buckets;
+    };
+    /*一个完整的只读快照*/
+    struct snapshot{
+        shard* shards[SHARD_COUNT];
+        /*索引是否完整。doc_root中有指向目录的符号链接(其下的路径不被索引)或者部分目录无法监视时，
+          查找不到不能断定为404*/
+        bool authoritative;
+    };
+    /*读者计数器，按缓存行对齐避免伪共享*/
+    struct alignas(64) reader_count{
+        std::atomic< long > count;
+    };
+    typedef std::map< std::string, docindex_entry > shard_map;
+
+private:
+    static void* worker(void* arg);
+    void run();
+    static uint64_t hash(const char* data, size_t len);
+
+    /*以下函数只在写者(inotify线程或open)中调用*/
+    /*只在doc_root不是可访问的目录时返回false，不完整时设置m_incomplete*/
+    bool rebuild();
+    /*快照无效时返回false*/
+    bool load_snapshot(const char* name);
+    /*重新读取目录rel的直接子项，children为快照中rel的子项*/
+    bool rescan(const std::string& rel, const std::vector< std::string >& children);
+    bool scan(const std::string& rel);
+    bool add_watch(const std::string& rel);
+    void insert(const std::string& rel, const struct stat& st);
+    void remove_subtree(const std::string& rel);
+    void refresh(const std::string& rel);
+    void handle_events(const char* buf, ssize_t len);
+    void publish();
+    shard* build_shard(const shard_map& map);
+    /*等待所有可能持有旧快照的读者离开*/
+    void synchronize();
+
+private:
+    std::string m_root;
+    int m_inotify_fd;
+    /*用于通知inotify线程退出的eventfd*/
+    int m_stop_fd;
+    pthread_t m_thread;
+    bool m_running;
+
+    /*写者维护的可变索引，按分片存放*/
+    shard_map m_master[SHARD_COUNT];
+    bool m_dirty[SHARD_COUNT];
+    /*监视描述符与目录路径的对应关系*/
+    std::map< int, std::string > m_wd_paths;
+    std::map< std::string, int > m_path_wds;
+    std::set< std::string > m_symlink_dirs;
+    /*有目录无法监视，索引不完整*/
+    bool m_incomplete;
+    /*inotify事件队列溢出等情况下需要完整重建*/
+    bool m_need_rebuild;
+    /*保护以上写者状态，使save_snapshot可以与inotify线程并发执行*/
+    locker m_writer_lock;
+
+    /*当前发布的快照*/
+    std::atomic< snapshot* > m_snapshot;
+    /*读者根据m_epoch的奇偶选择计数器，写者翻转m_epoch后等待旧计数器归零*/
+    std::atomic< unsigned > m_epoch;
+    reader_count m_readers[2];
+};
+
+#endif
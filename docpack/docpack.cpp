@@ -0,0 +1,432 @@
+#include "docpack.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*扩展名与Content-Type的对应关系*/
+static const char* content_types[][2] = {
+    {".html", "text/html; charset=utf-8"},
+    {".htm", "text/html; charset=utf-8"},
+    {".css", "text/css; charset=utf-8"},
+    {".js", "application/javascript; charset=utf-8"},
+    {".json", "application/json"},
+    {".txt", "text/plain; charset=utf-8"},
+    {".xml", "application/xml"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".ico", "image/x-icon"},
+    {".webp", "image/webp"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".wasm", "application/wasm"},
+    {".pdf", "application/pdf"},
+    {".mp4", "video/mp4"},
+};
+static const char* default_content_type = "application/octet-stream";
+
+uint64_t docpack_hash(const char* data, size_t len){
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i ++){
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align){
+    return (value + align - 1) & ~(align - 1);
+}
+
+static bool ends_with(const std::string& str, const char* suffix){
+    size_t len = strlen(suffix);
+    return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+static const char* guess_content_type(const std::string& path){
+    size_t dot = path.rfind('.');
+    if(dot == std::string::npos || path.find('/', dot) != std::string::npos){
+        return default_content_type;
+    }
+    for(size_t i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i ++){
+        if(strcasecmp(path.c_str() + dot, content_types[i][0]) == 0){
+            return content_types[i][1];
+        }
+    }
+    return default_content_type;
+}
+
+/*打包时一个文件的信息*/
+struct pack_item{
+    std::string real_path;
+    struct stat st;
+    /*预压缩版本，gzip_path为空表示没有*/
+    std::string gzip_path;
+    struct stat gzip_st;
+};
+
+/*递归遍历目录，收集所有普通文件，路径以'/'开头*/
+static bool collect_files(const std::string& root, const std::string& rel,
+                          std::map< std::string, struct stat >& files){
+    std::string dir_path = root + rel;
+    DIR* dir = opendir(dir_path.c_str());
+    if(!dir){
+        fprintf(stderr, "docpack: cannot open %s: %s\n", dir_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    struct dirent* ent;
+    while(ok && (ent = readdir(dir)) != NULL){
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+            continue;
+        }
+        std::string child = rel + "/" + ent->d_name;
+        struct stat st;
+        if(lstat((root + child).c_str(), &st) < 0){
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)){
+            ok = collect_files(root, child, files);
+        }
+        else if(S_ISREG(st.st_mode)){
+            files[child] = st;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+/*把real_path的内容拷贝到fd的offset处，同时计算内容哈希*/
+static bool copy_file(int out_fd, uint64_t offset, const std::string& real_path,
+                      uint64_t size, uint64_t* hash){
+    int fd = open(real_path.c_str(), O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "docpack: cannot open %s: %s\n", real_path.c_str(), strerror(errno));
+        return false;
+    }
+    static char buf[64 * 1024];
+    uint64_t h = 14695981039346656037ULL;
+    uint64_t copied = 0;
+    while(true){
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            close(fd);
+            return false;
+        }
+        if(n == 0){
+            break;
+        }
+        /*文件在打包过程中被修改*/
+        if(copied + n > size){
+            break;
+        }
+        for(ssize_t i = 0; i < n; i ++){
+            h ^= (unsigned char)buf[i];
+            h *= 1099511628211ULL;
+        }
+        if(pwrite(out_fd, buf, n, offset + copied) != n){
+            close(fd);
+            return false;
+        }
+        copied += n;
+    }
+    close(fd);
+    if(copied != size){
+        fprintf(stderr, "docpack: %s changed while packing\n", real_path.c_str());
+        return false;
+    }
+    *hash = h;
+    return true;
+}
+
+bool docpack_build(const char* doc_root, const char* out_path){
+    std::string root(doc_root);
+    while(root.size() > 1 && root[root.size() - 1] == '/'){
+        root.erase(root.size() - 1);
+    }
+    std::map< std::string, struct stat > files;
+    if(!collect_files(root, "", files)){
+        return false;
+    }
+
+    /*foo.gz与foo同时存在时，把foo.gz作为foo的预压缩版本而不是单独的文件*/
+    std::map< std::string, pack_item > items;
+    for(std::map< std::string, struct stat >::iterator it = files.begin(); it != files.end(); ++ it){
+        if(ends_with(it->first, ".gz") &&
+           files.count(it->first.substr(0, it->first.size() - 3))){
+            continue;
+        }
+        pack_item& item = items[it->first];
+        item.real_path = root + it->first;
+        item.st = it->second;
+        std::map< std::string, struct stat >::iterator gz = files.find(it->first + ".gz");
+        if(gz != files.end()){
+            item.gzip_path = root + gz->first;
+            item.gzip_st = gz->second;
+        }
+    }
+
+    uint32_t entry_count = items.size();
+    uint32_t bucket_count = 16;
+    while(bucket_count < entry_count * 2){
+        bucket_count <<= 1;
+    }
+
+    /*建立字符串区：路径及去重后的Content-Type*/
+    std::string strings;
+    std::map< std::string, uint32_t > type_offsets;
+    std::vector< docpack_entry > entries(entry_count);
+    std::vector< uint32_t > buckets(bucket_count, 0);
+
+    uint32_t index = 0;
+    for(std::map< std::string, pack_item >::iterator it = items.begin(); it != items.end(); ++ it, ++ index){
+        docpack_entry& entry = entries[index];
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = docpack_hash(it->first.data(), it->first.size());
+        entry.path_offset = strings.size();
+        entry.path_len = it->first.size();
+        strings.append(it->first);
+        strings.push_back('\0');
+
+        std::string type = guess_content_type(it->first);
+        if(!type_offsets.count(type)){
+            type_offsets[type] = strings.size();
+            strings.append(type);
+            strings.push_back('\0');
+        }
+        entry.type_offset = type_offsets[type];
+        entry.type_len = type.size();
+        entry.data_size = it->second.st.st_size;
+        entry.gzip_size = it->second.gzip_path.empty() ? 0 : it->second.gzip_st.st_size;
+        entry.mode = it->second.st.st_mode;
+        entry.mtime = it->second.st.st_mtime;
+
+        /*开放寻址，线性探测*/
+        uint32_t slot = entry.hash & (bucket_count - 1);
+        while(buckets[slot] != 0){
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        buckets[slot] = index + 1;
+    }
+
+    docpack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DOCPACK_MAGIC, sizeof(DOCPACK_MAGIC));
+    header.version = DOCPACK_VERSION;
+    header.entry_count = entry_count;
+    header.bucket_count = bucket_count;
+    header.entry_offset = align_up(sizeof(header), 8);
+    header.bucket_offset = header.entry_offset + (uint64_t)entry_count * sizeof(docpack_entry);
+    header.string_offset = header.bucket_offset + (uint64_t)bucket_count * sizeof(uint32_t);
+    header.string_size = strings.size();
+
+    /*文件内容从元数据之后按4KB对齐依次存放*/
+    uint64_t offset = align_up(header.string_offset + header.string_size, DOCPACK_ALIGN);
+    for(uint32_t i = 0; i < entry_count; i ++){
+        entries[i].data_offset = offset;
+        offset = align_up(offset + entries[i].data_size, DOCPACK_ALIGN);
+        if(entries[i].gzip_size != 0){
+            entries[i].gzip_offset = offset;
+            offset = align_up(offset + entries[i].gzip_size, DOCPACK_ALIGN);
+        }
+    }
+    header.file_size = offset;
+
+    std::string tmp_path = std::string(out_path) + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        fprintf(stderr, "docpack: cannot create %s: %s\n", tmp_path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = ftruncate(fd, header.file_size) == 0;
+
+    index = 0;
+    for(std::map< std::string, pack_item >::iterator it = items.begin(); ok && it != items.end(); ++ it, ++ index){
+        docpack_entry& entry = entries[index];
+        uint64_t hash = 0;
+        ok = copy_file(fd, entry.data_offset, it->second.real_path, entry.data_size, &hash);
+        if(ok && entry.gzip_size != 0){
+            uint64_t gzip_hash = 0;
+            ok = copy_file(fd, entry.gzip_offset, it->second.gzip_path, entry.gzip_size, &gzip_hash);
+            snprintf(entry.gzip_etag, sizeof(entry.gzip_etag), "\"%llx-%llx-gz\"",
+                     (unsigned long long)entry.gzip_size, (unsigned long long)gzip_hash);
+        }
+        snprintf(entry.etag, sizeof(entry.etag), "\"%llx-%llx\"",
+                 (unsigned long long)entry.data_size, (unsigned long long)hash);
+    }
+
+    /*元数据最后写入*/
+    ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    ok = ok && (entry_count == 0 ||
+                pwrite(fd, &entries[0], entry_count * sizeof(docpack_entry), header.entry_offset)
+                    == (ssize_t)(entry_count * sizeof(docpack_entry)));
+    ok = ok && pwrite(fd, &buckets[0], bucket_count * sizeof(uint32_t), header.bucket_offset)
+                    == (ssize_t)(bucket_count * sizeof(uint32_t));
+    ok = ok && (strings.empty() ||
+                pwrite(fd, strings.data(), strings.size(), header.string_offset) == (ssize_t)strings.size());
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+
+    if(!ok || rename(tmp_path.c_str(), out_path) < 0){
+        fprintf(stderr, "docpack: failed to write %s\n", out_path);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+docpack_archive::docpack_archive():
+m_base(NULL), m_size(0), m_header(NULL), m_entries(NULL), m_buckets(NULL), m_strings(NULL), m_refs(1){
+}
+
+docpack_archive::~docpack_archive(){
+    if(m_base){
+        munmap(m_base, m_size);
+    }
+}
+
+docpack_archive* docpack_archive::load(const char* path, bool populate){
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(docpack_header)){
+        close(fd);
+        return NULL;
+    }
+    int flags = MAP_SHARED;
+    if(populate){
+        flags |= MAP_POPULATE;
+    }
+    char* base = (char*)mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        return NULL;
+    }
+
+    docpack_archive* archive = new docpack_archive();
+    archive->m_base = base;
+    archive->m_size = st.st_size;
+    const docpack_header* header = (const docpack_header*)base;
+
+    /*校验文件头，防止损坏的归档导致越界访问*/
+    uint64_t size = st.st_size;
+    if(memcmp(header->magic, DOCPACK_MAGIC, sizeof(DOCPACK_MAGIC)) != 0 ||
+       header->version != DOCPACK_VERSION || header->file_size != size ||
+       header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+       header->entry_offset + (uint64_t)header->entry_count * sizeof(docpack_entry) > header->bucket_offset ||
+       header->bucket_offset + (uint64_t)header->bucket_count * sizeof(uint32_t) > header->string_offset ||
+       header->string_offset + header->string_size > size){
+        archive->put();
+        return NULL;
+    }
+    archive->m_header = header;
+    archive->m_entries = (const docpack_entry*)(base + header->entry_offset);
+    archive->m_buckets = (const uint32_t*)(base + header->bucket_offset);
+    archive->m_strings = base + header->string_offset;
+
+    for(uint32_t i = 0; i < header->entry_count; i ++){
+        const docpack_entry& entry = archive->m_entries[i];
+        if(entry.path_offset + (uint64_t)entry.path_len >= header->string_size ||
+           entry.type_offset + (uint64_t)entry.type_len >= header->string_size ||
+           entry.data_offset + entry.data_size > size ||
+           entry.gzip_offset + entry.gzip_size > size){
+            archive->put();
+            return NULL;
+        }
+    }
+    for(uint32_t i = 0; i < header->bucket_count; i ++){
+        if(archive->m_buckets[i] > header->entry_count){
+            archive->put();
+            return NULL;
+        }
+    }
+
+    /*未预读时，文件内容按随机访问处理，元数据则提示内核尽快读入*/
+    if(!populate){
+        madvise(base, st.st_size, MADV_RANDOM);
+        madvise(base, header->string_offset + header->string_size, MADV_WILLNEED);
+    }
+    return archive;
+}
+
+const docpack_entry* docpack_archive::lookup(const char* path, size_t len) const{
+    uint64_t hash = docpack_hash(path, len);
+    uint32_t mask = m_header->bucket_count - 1;
+    uint32_t slot = hash & mask;
+    for(uint32_t i = 0; i <= mask; i ++){
+        uint32_t index = m_buckets[slot];
+        if(index == 0){
+            return NULL;
+        }
+        const docpack_entry* entry = m_entries + index - 1;
+        if(entry->hash == hash && entry->path_len == len &&
+           memcmp(m_strings + entry->path_offset, path, len) == 0){
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+void docpack_archive::get(){
+    m_refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void docpack_archive::put(){
+    if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
+
+docpack::docpack(): m_current(NULL){
+}
+
+docpack::~docpack(){
+    if(m_current){
+        m_current->put();
+    }
+}
+
+bool docpack::open(const char* path, bool populate){
+    docpack_archive* archive = docpack_archive::load(path, populate);
+    if(!archive){
+        return false;
+    }
+    m_lock.lock();
+    docpack_archive* old = m_current;
+    m_current = archive;
+    m_lock.unlock();
+    /*正在使用旧归档的请求持有引用，最后一个引用释放时才解除映射*/
+    if(old){
+        old->put();
+    }
+    return true;
+}
+
+docpack_archive* docpack::acquire(){
+    m_lock.lock();
+    docpack_archive* archive = m_current;
+    if(archive){
+        archive->get();
+    }
+    m_lock.unlock();
+    return archive;
+}
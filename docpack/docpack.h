@@ -0,0 +1,120 @@
+#ifndef DOCPACK_H
+#define DOCPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "locker.h"
+
+/*docpack归档格式：
+  [docpack_header][docpack_entry * entry_count][uint32_t * bucket_count][字符串区][按4KB对齐的文件内容...]
+  条目按路径哈希放入开放寻址的桶数组中，查找一次哈希即可定位，整个归档只需mmap一次*/
+
+/*归档魔数及版本号*/
+#define DOCPACK_MAGIC "DOCPACK"
+#define DOCPACK_VERSION 2
+/*文件内容的对齐粒度*/
+#define DOCPACK_ALIGN 4096
+/*ETag最大长度，包含两侧引号以及结尾的'\0'*/
+#define DOCPACK_ETAG_LEN 40
+
+/*归档文件头*/
+struct docpack_header{
+    char magic[8];
+    uint32_t version;
+    /*条目数量*/
+    uint32_t entry_count;
+    /*哈希桶数量，必须是2的幂*/
+    uint32_t bucket_count;
+    uint32_t reserved;
+    /*条目数组、哈希桶数组以及字符串区在归档中的偏移*/
+    uint64_t entry_offset;
+    uint64_t bucket_offset;
+    uint64_t string_offset;
+    uint64_t string_size;
+    /*整个归档的大小，加载时用于校验*/
+    uint64_t file_size;
+};
+
+/*归档中一个文件的元数据*/
+struct docpack_entry{
+    /*路径的哈希值*/
+    uint64_t hash;
+    /*路径(以'/'开头，相对于doc_root)在字符串区中的位置及长度*/
+    uint32_t path_offset;
+    uint32_t path_len;
+    /*Content-Type在字符串区中的位置及长度*/
+    uint32_t type_offset;
+    uint32_t type_len;
+    /*文件内容在归档中的位置及大小*/
+    uint64_t data_offset;
+    uint64_t data_size;
+    /*预压缩(gzip)版本的位置及大小，没有时gzip_size为0*/
+    uint64_t gzip_offset;
+    uint64_t gzip_size;
+    /*原文件的权限位及修改时间*/
+    uint32_t mode;
+    uint32_t reserved;
+    int64_t mtime;
+    /*预先计算好的ETag，形如"大小-哈希"；预压缩版本是不同的表示，有自己的ETag，没有时为空串*/
+    char etag[DOCPACK_ETAG_LEN];
+    char gzip_etag[DOCPACK_ETAG_LEN];
+};
+
+/*计算路径哈希(FNV-1a)，打包工具和服务器必须一致*/
+uint64_t docpack_hash(const char* data, size_t len);
+
+/*将doc_root下的所有普通文件打包到out_path，
+  与foo同目录的foo.gz被当作foo的预压缩版本；先写临时文件再rename，保证替换是原子的*/
+bool docpack_build(const char* doc_root, const char* out_path);
+
+/*一个已经映射到内存中的只读归档，通过引用计数管理生命周期*/
+class docpack_archive{
+public:
+    /*映射归档文件，populate为true时使用MAP_POPULATE预先读入所有页，失败返回NULL*/
+    static docpack_archive* load(const char* path, bool populate = true);
+
+    /*按路径查找文件，找不到返回NULL；path不需要以'\0'结尾*/
+    const docpack_entry* lookup(const char* path, size_t len) const;
+    /*获得条目对应的内容、预压缩内容以及Content-Type*/
+    const char* data(const docpack_entry* entry) const { return m_base + entry->data_offset; }
+    const char* gzip_data(const docpack_entry* entry) const { return m_base + entry->gzip_offset; }
+    const char* content_type(const docpack_entry* entry) const { return m_strings + entry->type_offset; }
+
+    /*增加/减少引用，引用减为0时解除映射并释放对象*/
+    void get();
+    void put();
+
+private:
+    docpack_archive();
+    ~docpack_archive();
+
+private:
+    /*归档映射到内存中的起始位置及大小*/
+    char* m_base;
+    size_t m_size;
+    const docpack_header* m_header;
+    const docpack_entry* m_entries;
+    const uint32_t* m_buckets;
+    const char* m_strings;
+    std::atomic< int > m_refs;
+};
+
+/*服务器使用的归档句柄，支持在不重启的情况下原子地替换为新的归档*/
+class docpack{
+public:
+    docpack();
+    ~docpack();
+    /*加载path处的归档，若已加载旧归档则原子替换，旧归档在最后一个请求结束后释放*/
+    bool open(const char* path, bool populate = true);
+    /*获得当前归档并增加引用，用完后调用docpack_archive::put()；没有归档时返回NULL*/
+    docpack_archive* acquire();
+
+private:
+    docpack_archive* m_current;
+    /*保护m_current的互斥锁，只在取得引用和替换时持有*/
+    locker m_lock;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "handoff.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+/*旧进程发给新进程的消息，监听socket作为SCM_RIGHTS附带*/
+struct handoff_message{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    char snapshot[handoff::SNAPSHOT_NAME_LEN];
+};
+
+static const char HANDOFF_MAGIC[8] = "HANDOFF";
+static const uint32_t HANDOFF_VERSION = 1;
+/*新进程通知旧进程已就绪的字节*/
+static const char READY_BYTE = 'R';
+/*新进程等待旧进程应答的最长时间(秒)*/
+static const int RECEIVE_TIMEOUT_SEC = 5;
+
+static bool make_address(const char* path, struct sockaddr_un* addr){
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path)){
+        fprintf(stderr, "handoff: path too long: %s\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+handoff::handoff(): m_listen_fd(-1), m_conn(-1){
+}
+
+handoff::~handoff(){
+    if(m_listen_fd >= 0){
+        close(m_listen_fd);
+        unlink(m_path.c_str());
+    }
+    if(m_conn >= 0){
+        close(m_conn);
+    }
+}
+
+bool handoff::listen(const char* path){
+    struct sockaddr_un addr;
+    if(!make_address(path, &addr)){
+        return false;
+    }
+    m_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_listen_fd < 0){
+        return false;
+    }
+    /*上一个进程异常退出时可能留下了socket文件*/
+    unlink(path);
+    /*只允许同一用户的进程接管监听socket*/
+    mode_t old_mask = umask(077);
+    int ret = bind(m_listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if(ret < 0 || ::listen(m_listen_fd, 1) < 0){
+        fprintf(stderr, "handoff: cannot listen on %s: %s\n", path, strerror(errno));
+        close(m_listen_fd);
+        m_listen_fd = -1;
+        return false;
+    }
+    m_path = path;
+    return true;
+}
+
+int handoff::accept_successor(const int* fds, int count, const char* snapshot){
+    if(count < 0 || count > MAX_FDS){
+        return -1;
+    }
+    int conn = accept4(m_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if(conn < 0){
+        return -1;
+    }
+    handoff_message msg;
+    memset(&msg, 0, sizeof(msg));
+    memcpy(msg.magic, HANDOFF_MAGIC, sizeof(msg.magic));
+    msg.version = HANDOFF_VERSION;
+    msg.count = count;
+    if(snapshot){
+        snprintf(msg.snapshot, sizeof(msg.snapshot), "%s", snapshot);
+    }
+
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if(count > 0){
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+    if(sendmsg(conn, &hdr, MSG_NOSIGNAL) != (ssize_t)sizeof(msg)){
+        fprintf(stderr, "handoff: cannot send sockets: %s\n", strerror(errno));
+        close(conn);
+        return -1;
+    }
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+    return conn;
+}
+
+bool handoff::successor_ready(int conn){
+    char byte = 0;
+    ssize_t ret = recv(conn, &byte, 1, 0);
+    close(conn);
+    return ret == 1 && byte == READY_BYTE;
+}
+
+bool handoff::receive(const char* path, int* fds, int* count, char* snapshot, size_t snapshot_len){
+    struct sockaddr_un addr;
+    if(!make_address(path, &addr)){
+        return false;
+    }
+    m_conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(m_conn < 0){
+        return false;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = RECEIVE_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(m_conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if(connect(m_conn, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        fprintf(stderr, "handoff: cannot connect to %s: %s\n", path, strerror(errno));
+        close(m_conn);
+        m_conn = -1;
+        return false;
+    }
+
+    handoff_message msg;
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    ssize_t ret = recvmsg(m_conn, &hdr, MSG_CMSG_CLOEXEC);
+
+    /*先取出收到的描述符，出错时也要关闭它们*/
+    int received = 0;
+    int received_fds[MAX_FDS];
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); ret > 0 && cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(int i = 0; i < n && received < MAX_FDS; i ++){
+                memcpy(&received_fds[received ++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            }
+        }
+    }
+    bool ok = ret == (ssize_t)sizeof(msg) && !(hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) &&
+              memcmp(msg.magic, HANDOFF_MAGIC, sizeof(msg.magic)) == 0 && msg.version == HANDOFF_VERSION &&
+              (int)msg.count == received && received <= *count;
+    if(!ok){
+        fprintf(stderr, "handoff: invalid message from %s\n", path);
+        for(int i = 0; i < received; i ++){
+            close(received_fds[i]);
+        }
+        close(m_conn);
+        m_conn = -1;
+        return false;
+    }
+    memcpy(fds, received_fds, sizeof(int) * received);
+    *count = received;
+    msg.snapshot[sizeof(msg.snapshot) - 1] = '\0';
+    snprintf(snapshot, snapshot_len, "%s", msg.snapshot);
+    return true;
+}
+
+bool handoff::ready(){
+    if(m_conn < 0){
+        return false;
+    }
+    bool ok = send(m_conn, &READY_BYTE, 1, MSG_NOSIGNAL) == 1;
+    close(m_conn);
+    m_conn = -1;
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <string>
+
+/*平滑重启：新旧进程通过Unix域socket交接，监听socket始终处于打开状态，不会拒绝任何连接。
+  1. 旧进程用listen在控制路径上等待后继进程，并把listen_fd加入epoll；
+  2. 新进程启动后调用receive，旧进程在listen_fd可读时保存docindex快照，调用accept_successor
+     通过SCM_RIGHTS把监听socket和快照名发给新进程；
+  3. 新进程用收到的快照打开docindex，把监听socket加入epoll开始accept后调用ready；
+  4. 旧进程在与新进程的连接可读时调用successor_ready，返回true后停止accept(从epoll中移除并关闭监听socket)，
+     设置http_conn::m_draining并对每个活跃连接调用http_conn::drain，等已有连接处理完(或者超时)后退出。
+  新进程在ready之前失败时连接被关闭，successor_ready返回false，旧进程继续正常服务*/
+class handoff{
+public:
+    /*一次最多交接的监听socket数量*/
+    static const int MAX_FDS = 16;
+    /*快照名的最大长度，包含结尾的'\0'*/
+    static const int SNAPSHOT_NAME_LEN = 64;
+
+public:
+    handoff();
+    ~handoff();
+    /*旧进程：在path上等待后继进程连接*/
+    bool listen(const char* path);
+    int listen_fd() const { return m_listen_fd; }
+    /*旧进程：listen_fd可读时调用，接受后继进程并把fds和快照名(可以为NULL)发给它。
+      返回与后继进程的连接，需要在其可读时调用successor_ready；失败返回-1*/
+    int accept_successor(const int* fds, int count, const char* snapshot);
+    /*旧进程：与后继进程的连接可读时调用并关闭该连接，后继进程已经开始accept时返回true*/
+    static bool successor_ready(int conn);
+
+    /*新进程：连接旧进程并接收监听socket和快照名。count传入fds的容量，返回收到的数量；
+      snapshot为空串表示旧进程没有保存快照*/
+    bool receive(const char* path, int* fds, int* count, char* snapshot, size_t snapshot_len);
+    /*新进程：已经开始accept，通知旧进程停止accept*/
+    bool ready();
+
+private:
+    int m_listen_fd;
+    std::string m_path;
+    /*新进程与旧进程的连接*/
+    int m_conn;
+};
+
+#endif
@@ -0,0 +1,539 @@
+#include "hpack.h"
+
+#include <string.h>
+
+/*RFC 7541附录A的静态表*/
+static const hpack_header static_table[hpack_table::STATIC_COUNT] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/*RFC 7541附录B的Huffman编码表，最后一项为EOS*/
+static const uint32_t huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+static const uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/*Huffman解码树，叶子节点的sym为符号，内部节点的sym为-1*/
+struct huffman_node{
+    int16_t child[2];
+    int16_t sym;
+};
+static const int HUFFMAN_NODES = 2 * 257 - 1;
+
+struct huffman_tree{
+    huffman_node nodes[HUFFMAN_NODES];
+    huffman_tree(){
+        int count = 1;
+        nodes[0].child[0] = nodes[0].child[1] = 0;
+        nodes[0].sym = -1;
+        for(int sym = 0; sym < 257; sym ++){
+            int node = 0;
+            for(int bit = huffman_lengths[sym] - 1; bit >= 0; bit --){
+                int b = (huffman_codes[sym] >> bit) & 1;
+                if(nodes[node].child[b] == 0){
+                    nodes[count].child[0] = nodes[count].child[1] = 0;
+                    nodes[count].sym = -1;
+                    nodes[node].child[b] = count ++;
+                }
+                node = nodes[node].child[b];
+            }
+            nodes[node].sym = sym;
+        }
+    }
+};
+
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out){
+    /*第一次使用时构造，C++11保证局部静态变量的初始化是线程安全的*/
+    static const huffman_tree tree;
+    int node = 0;
+    /*上一个符号之后读入的位数，以及这些位是否全为1*/
+    int depth = 0;
+    bool all_ones = true;
+    for(size_t i = 0; i < len; i ++){
+        for(int bit = 7; bit >= 0; bit --){
+            int b = (data[i] >> bit) & 1;
+            node = tree.nodes[node].child[b];
+            depth ++;
+            all_ones = all_ones && b;
+            if(node == 0){
+                return false;
+            }
+            if(tree.nodes[node].sym >= 0){
+                /*EOS不允许出现在编码中*/
+                if(tree.nodes[node].sym == 256){
+                    return false;
+                }
+                out.push_back((char)tree.nodes[node].sym);
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    /*填充必须是EOS编码的前缀(全1)且不超过7位*/
+    return depth <= 7 && all_ones;
+}
+
+void hpack_huffman_encode(const char* data, size_t len, std::string& out){
+    uint64_t bits = 0;
+    int count = 0;
+    for(size_t i = 0; i < len; i ++){
+        unsigned char c = data[i];
+        bits = (bits << huffman_lengths[c]) | huffman_codes[c];
+        count += huffman_lengths[c];
+        while(count >= 8){
+            count -= 8;
+            out.push_back((char)(bits >> count));
+        }
+    }
+    /*用EOS的前缀(全1)填充到字节边界*/
+    if(count > 0){
+        bits = (bits << (8 - count)) | (0xff >> count);
+        out.push_back((char)bits);
+    }
+}
+
+size_t hpack_huffman_length(const char* data, size_t len){
+    size_t bits = 0;
+    for(size_t i = 0; i < len; i ++){
+        bits += huffman_lengths[(unsigned char)data[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+
+hpack_table::hpack_table(size_t max_size): m_size(0), m_max_size(max_size){
+}
+
+void hpack_table::evict(size_t limit){
+    while(m_size > limit && !m_entries.empty()){
+        m_size -= m_entries.back().name.size() + m_entries.back().value.size() + 32;
+        m_entries.pop_back();
+    }
+}
+
+void hpack_table::set_max_size(size_t max_size){
+    m_max_size = max_size;
+    evict(max_size);
+}
+
+void hpack_table::add(const std::string& name, const std::string& value){
+    size_t size = name.size() + value.size() + 32;
+    /*比整个表还大的字段会清空动态表，且自身不被加入*/
+    if(size > m_max_size){
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    hpack_header header;
+    header.name = name;
+    header.value = value;
+    m_entries.push_front(header);
+    m_size += size;
+}
+
+bool hpack_table::get(size_t index, const std::string** name, const std::string** value) const{
+    if(index == 0){
+        return false;
+    }
+    if(index <= STATIC_COUNT){
+        *name = &static_table[index - 1].name;
+        *value = &static_table[index - 1].value;
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= m_entries.size()){
+        return false;
+    }
+    *name = &m_entries[index].name;
+    *value = &m_entries[index].value;
+    return true;
+}
+
+size_t hpack_table::find(const std::string& name, const std::string& value, size_t* name_index) const{
+    *name_index = 0;
+    for(size_t i = 0; i < STATIC_COUNT; i ++){
+        if(static_table[i].name == name){
+            if(static_table[i].value == value){
+                return i + 1;
+            }
+            if(*name_index == 0){
+                *name_index = i + 1;
+            }
+        }
+    }
+    for(size_t i = 0; i < m_entries.size(); i ++){
+        if(m_entries[i].name == name){
+            if(m_entries[i].value == value){
+                return STATIC_COUNT + 1 + i;
+            }
+            if(*name_index == 0){
+                *name_index = STATIC_COUNT + 1 + i;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*解码prefix位前缀的整数*/
+static bool decode_int(const uint8_t*& p, const uint8_t* end, int prefix, size_t* value){
+    if(p >= end){
+        return false;
+    }
+    uint8_t mask = (1 << prefix) - 1;
+    size_t v = *p ++ & mask;
+    if(v < mask){
+        *value = v;
+        return true;
+    }
+    for(int shift = 0; shift <= 28; shift += 7){
+        if(p >= end){
+            return false;
+        }
+        uint8_t b = *p ++;
+        v += (size_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)){
+            *value = v;
+            return true;
+        }
+    }
+    /*过长的整数视为错误*/
+    return false;
+}
+
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out){
+    if(p >= end){
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    size_t len;
+    if(!decode_int(p, end, 7, &len) || len > (size_t)(end - p)){
+        return false;
+    }
+    out.clear();
+    if(huffman){
+        if(!hpack_huffman_decode(p, len, out)){
+            return false;
+        }
+    }
+    else{
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+/*跳过一个字符串，不解码Huffman编码*/
+static bool skip_string(const uint8_t*& p, const uint8_t* end){
+    size_t len;
+    if(!decode_int(p, end, 7, &len) || len > (size_t)(end - p)){
+        return false;
+    }
+    p += len;
+    return true;
+}
+
+hpack_decoder::hpack_decoder(size_t settings_table_size):
+m_table(settings_table_size), m_settings_table_size(settings_table_size){
+}
+
+bool hpack_decoder::decode(const uint8_t* data, size_t len, std::vector< hpack_header >& headers){
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    size_t list_size = 0;
+    while(p < end){
+        uint8_t b = *p;
+        hpack_header header;
+        if(b & 0x80){
+            /*索引字段*/
+            size_t index;
+            const std::string* name;
+            const std::string* value;
+            if(!decode_int(p, end, 7, &index) || !m_table.get(index, &name, &value)){
+                return false;
+            }
+            header.name = *name;
+            header.value = *value;
+        }
+        else if((b & 0xe0) == 0x20){
+            /*动态表大小更新只能出现在头部块开头*/
+            size_t size;
+            if(!headers.empty() || !decode_int(p, end, 5, &size) || size > m_settings_table_size){
+                return false;
+            }
+            m_table.set_max_size(size);
+            continue;
+        }
+        else{
+            /*字面字段：01为加入动态表，0000为不加入，0001为永不加入*/
+            bool indexing = (b & 0xc0) == 0x40;
+            size_t index;
+            if(!decode_int(p, end, indexing ? 6 : 4, &index)){
+                return false;
+            }
+            if(index == 0){
+                if(!decode_string(p, end, header.name)){
+                    return false;
+                }
+            }
+            else{
+                const std::string* name;
+                const std::string* value;
+                if(!m_table.get(index, &name, &value)){
+                    return false;
+                }
+                header.name = *name;
+            }
+            if(!decode_string(p, end, header.value)){
+                return false;
+            }
+            if(indexing){
+                m_table.add(header.name, header.value);
+            }
+        }
+        list_size += header.name.size() + header.value.size() + 32;
+        if(list_size > MAX_HEADER_LIST_SIZE){
+            return false;
+        }
+        headers.push_back(header);
+    }
+    return true;
+}
+
+
+/*本块中加入动态表的字段使之前的动态表索引整体后移added个位置*/
+int hpack_decoder::find(const uint8_t* data, size_t len, const std::string& name, std::string& value) const{
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    size_t added = 0;
+    while(p < end){
+        uint8_t b = *p;
+        if((b & 0xe0) == 0x20){
+            return -1;
+        }
+        bool indexed = b & 0x80;
+        bool indexing = (b & 0xc0) == 0x40;
+        size_t index;
+        if(!decode_int(p, end, indexed ? 7 : (indexing ? 6 : 4), &index)){
+            return -1;
+        }
+        const std::string* entry_name = NULL;
+        const std::string* entry_value = NULL;
+        std::string literal_name;
+        if(index > hpack_table::STATIC_COUNT){
+            if(index - hpack_table::STATIC_COUNT <= added){
+                return -1;
+            }
+            index -= added;
+        }
+        if(index != 0){
+            if(!m_table.get(index, &entry_name, &entry_value)){
+                return -1;
+            }
+        }
+        else if(indexed || !decode_string(p, end, literal_name)){
+            return -1;
+        }
+        else{
+            entry_name = &literal_name;
+        }
+        if(*entry_name == name){
+            if(indexed){
+                value = *entry_value;
+                return 1;
+            }
+            return decode_string(p, end, value) ? 1 : -1;
+        }
+        if(!indexed && !skip_string(p, end)){
+            return -1;
+        }
+        if(indexing){
+            added ++;
+        }
+    }
+    return 0;
+}
+
+
+/*编码prefix位前缀的整数，first为第一个字节中前缀之外的标志位*/
+static void encode_int(size_t value, int prefix, uint8_t first, std::string& out){
+    size_t mask = (1 << prefix) - 1;
+    if(value < mask){
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | mask));
+    value -= mask;
+    while(value >= 0x80){
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+/*Huffman编码更短时使用Huffman编码*/
+static void encode_string(const std::string& str, std::string& out){
+    size_t huffman_len = hpack_huffman_length(str.data(), str.size());
+    if(huffman_len < str.size()){
+        encode_int(huffman_len, 7, 0x80, out);
+        hpack_huffman_encode(str.data(), str.size(), out);
+    }
+    else{
+        encode_int(str.size(), 7, 0, out);
+        out.append(str);
+    }
+}
+
+hpack_encoder::hpack_encoder(): m_table(4096), m_size_update(false){
+}
+
+void hpack_encoder::set_max_table_size(size_t size){
+    /*本端的动态表不超过4096字节*/
+    if(size > 4096){
+        size = 4096;
+    }
+    if(size != m_table.max_size()){
+        m_table.set_max_size(size);
+        m_size_update = true;
+    }
+}
+
+void hpack_encoder::begin(std::string& out){
+    if(m_size_update){
+        encode_int(m_table.max_size(), 5, 0x20, out);
+        m_size_update = false;
+    }
+}
+
+void hpack_encoder::encode(const std::string& name, const std::string& value, bool indexing, std::string& out){
+    size_t name_index;
+    size_t index = m_table.find(name, value, &name_index);
+    if(index != 0){
+        encode_int(index, 7, 0x80, out);
+        return;
+    }
+    if(indexing){
+        encode_int(name_index, 6, 0x40, out);
+    }
+    else{
+        encode_int(name_index, 4, 0x00, out);
+    }
+    if(name_index == 0){
+        encode_string(name, out);
+    }
+    encode_string(value, out);
+    if(indexing){
+        m_table.add(name, value);
+    }
+}
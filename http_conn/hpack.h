@@ -0,0 +1,90 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*HPACK(RFC 7541)头部压缩，供HTTP/2使用*/
+
+/*一个头部字段*/
+struct hpack_header{
+    std::string name;
+    std::string value;
+};
+
+/*索引表：1~61为静态表，62开始为动态表(最新加入的字段索引最小)*/
+class hpack_table{
+public:
+    /*静态表的条目数*/
+    static const size_t STATIC_COUNT = 61;
+
+public:
+    hpack_table(size_t max_size = 4096);
+    /*修改动态表的大小上限，超出的字段被逐出*/
+    void set_max_size(size_t max_size);
+    size_t max_size() const { return m_max_size; }
+    /*把字段加入动态表*/
+    void add(const std::string& name, const std::string& value);
+    /*按索引获得字段，索引无效时返回false*/
+    bool get(size_t index, const std::string** name, const std::string** value) const;
+    /*查找完全匹配的字段并返回其索引；没有时返回0，若名字匹配则由name_index返回名字的索引*/
+    size_t find(const std::string& name, const std::string& value, size_t* name_index) const;
+
+private:
+    void evict(size_t limit);
+
+private:
+    /*动态表，front为最新的字段*/
+    std::deque< hpack_header > m_entries;
+    /*动态表当前大小，每个字段的大小为名字长度+值长度+32*/
+    size_t m_size;
+    size_t m_max_size;
+};
+
+/*头部块解码器，每个HTTP/2连接一个*/
+class hpack_decoder{
+public:
+    /*解码后的头部列表大小上限(字节)*/
+    static const size_t MAX_HEADER_LIST_SIZE = 64 * 1024;
+
+public:
+    /*settings_table_size为本端在SETTINGS_HEADER_TABLE_SIZE中通告的大小*/
+    hpack_decoder(size_t settings_table_size = 4096);
+    /*解码一个完整的头部块，出错(即连接错误COMPRESSION_ERROR)时返回false*/
+    bool decode(const uint8_t* data, size_t len, std::vector< hpack_header >& headers);
+    /*不修改动态表，在完整的头部块中查找第一个名为name的字段，只解码比较所需的名字和它的值。
+      找到时返回1，没有时返回0；引用了本块中新加入的字段、有动态表大小更新或者格式错误时返回-1*/
+    int find(const uint8_t* data, size_t len, const std::string& name, std::string& value) const;
+
+private:
+    hpack_table m_table;
+    size_t m_settings_table_size;
+};
+
+/*头部块编码器，每个HTTP/2连接一个*/
+class hpack_encoder{
+public:
+    hpack_encoder();
+    /*对端通过SETTINGS_HEADER_TABLE_SIZE修改了动态表上限，在下一个头部块的开头通知对端*/
+    void set_max_table_size(size_t size);
+    /*开始编码一个新的头部块*/
+    void begin(std::string& out);
+    /*编码一个字段追加到out，indexing为true时把字段加入动态表，使后续重复的字段只需一个字节*/
+    void encode(const std::string& name, const std::string& value, bool indexing, std::string& out);
+
+private:
+    hpack_table m_table;
+    /*是否需要在下一个头部块开头输出动态表大小更新*/
+    bool m_size_update;
+};
+
+/*Huffman编解码，解码出错(非法填充或者包含EOS)时返回false*/
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out);
+void hpack_huffman_encode(const char* data, size_t len, std::string& out);
+/*计算Huffman编码后的字节数*/
+size_t hpack_huffman_length(const char* data, size_t len);
+
+#endif
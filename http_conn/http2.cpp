@@ -0,0 +1,969 @@
+#include "http2.h"
+
+/*HTTP/1.1的响应体，HTTP/2复用同样的内容*/
+extern const char* ok_health_form;
+extern const char* error_400_form;
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_500_form;
+
+static const char CLIENT_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const char SWITCHING_PROTOCOLS[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+/*帧头长度*/
+static const size_t FRAME_HEADER_LEN = 9;
+/*优雅关闭时跟在第一个GOAWAY之后的PING的载荷，收到它的ACK时对端已经看到了GOAWAY*/
+static const char SHUTDOWN_PING[8] = {'s', 'h', 'u', 't', 'd', 'o', 'w', 'n'};
+
+static uint32_t get_u32(const uint8_t* p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static void put_u32(char* p, uint32_t v){
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+static void put_frame_header(char* p, size_t len, uint8_t type, uint8_t flags, uint32_t stream_id){
+    p[0] = (char)(len >> 16);
+    p[1] = (char)(len >> 8);
+    p[2] = (char)len;
+    p[3] = (char)type;
+    p[4] = (char)flags;
+    put_u32(p + 5, stream_id & 0x7fffffff);
+}
+
+/*解码HTTP2-Settings头部的base64url(无填充)，出错时返回false*/
+static bool base64url_decode(const char* in, std::string& out){
+    uint32_t acc = 0;
+    int bits = 0;
+    for(; *in && *in != '='; in ++){
+        char c = *in;
+        int v;
+        if(c >= 'A' && c <= 'Z') v = c - 'A';
+        else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if(c >= '0' && c <= '9') v = c - '0' + 52;
+        else if(c == '-' || c == '+') v = 62;
+        else if(c == '_' || c == '/') v = 63;
+        else return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8){
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return bits < 6;
+}
+
+/*按:path(不含查询字符串)分类*/
+static int classify_path(const char* path, size_t len){
+    const char* query = (const char*)memchr(path, '?', len);
+    return http_conn::classify_url(path, query ? query - path : len);
+}
+
+http2_session::http2_session():
+    m_preface_received(false), m_settings_received(false), m_last_stream_id(0),
+    m_header_stream(0), m_header_end_stream(false),
+    m_priority(http_conn::PRIORITY_STATIC), m_batch_priority(-1),
+    m_conn_send_window(DEFAULT_WINDOW), m_peer_initial_window(DEFAULT_WINDOW),
+    m_peer_max_frame(MAX_FRAME_SIZE), m_out_offset(0), m_out_bytes(0),
+    m_closing(false), m_goaway_received(false), m_goaway_sent(false), m_shutdown_started(false){
+}
+
+http2_session::~http2_session(){
+    for(std::map< uint32_t, stream* >::iterator it = m_streams.begin(); it != m_streams.end(); ++ it){
+        it->second->detached = true;
+    }
+    /*发送队列中的数据块仍引用着流，先清空队列再释放*/
+    while(!m_out.empty()){
+        stream* s = m_out.front().owner;
+        m_out.pop_front();
+        if(s){
+            s->pending --;
+            release_stream(s);
+        }
+    }
+    for(std::map< uint32_t, stream* >::iterator it = m_streams.begin(); it != m_streams.end(); ++ it){
+        release_stream(it->second);
+    }
+}
+
+int http2_session::check_preface(const char* data, size_t len){
+    size_t n = len < (size_t)PREFACE_LEN ? len : PREFACE_LEN;
+    if(memcmp(data, CLIENT_PREFACE, n) != 0){
+        return 0;
+    }
+    return n == (size_t)PREFACE_LEN ? 1 : -1;
+}
+
+void http2_session::start(){
+    /*服务器的连接前言：限制并发流数量和头部列表大小，其余参数使用默认值*/
+    char payload[12];
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(payload + 2, MAX_CONCURRENT_STREAMS);
+    payload[6] = 0;
+    payload[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    put_u32(payload + 8, hpack_decoder::MAX_HEADER_LIST_SIZE);
+    queue_frame(FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+bool http2_session::upgrade(const char* settings, const char* url, bool accept_gzip, const char* if_none_match){
+    std::string decoded;
+    if(!base64url_decode(settings, decoded) || decoded.size() % 6 != 0 ||
+       apply_settings((const uint8_t*)decoded.data(), decoded.size()) != NO_ERROR){
+        return false;
+    }
+    queue_raw(SWITCHING_PROTOCOLS, sizeof(SWITCHING_PROTOCOLS) - 1);
+    start();
+    /*升级前的请求成为流1，对端已经处于半关闭状态*/
+    stream* s = new stream();
+    s->id = 1;
+    s->remote_closed = true;
+    s->bad_request = false;
+    s->accept_gzip = accept_gzip;
+    s->path = url;
+    m_priority = classify_path(url, strlen(url));
+    if(if_none_match){
+        s->if_none_match = if_none_match;
+    }
+    s->send_window = m_peer_initial_window;
+    m_streams[1] = s;
+    m_last_stream_id = 1;
+    respond(s);
+    return true;
+}
+
+void http2_session::buffer_input(const char* data, size_t len){
+    if(!m_closing){
+        m_in.append(data, len);
+    }
+}
+
+int http2_session::count_requests(const char* data, size_t len){
+    int count = 0;
+    size_t pos = 0;
+    while(len - pos >= FRAME_HEADER_LEN){
+        const uint8_t* p = (const uint8_t*)data + pos;
+        uint32_t frame_len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        if(frame_len > MAX_FRAME_SIZE || len - pos - FRAME_HEADER_LEN < frame_len){
+            break;
+        }
+        if(p[3] == FRAME_HEADERS){
+            count ++;
+        }
+        pos += FRAME_HEADER_LEN + frame_len;
+    }
+    return count;
+}
+
+int http2_session::pending_requests() const{
+    size_t pos = m_preface_received ? 0 : PREFACE_LEN;
+    if(m_closing || m_in.size() < pos){
+        return 0;
+    }
+    return count_requests(m_in.data() + pos, m_in.size() - pos);
+}
+
+int http2_session::classify_requests(const char* data, size_t len){
+    std::string block;
+    if(!first_header_block(data, len, block)){
+        return http_conn::PRIORITY_STATIC;
+    }
+    hpack_decoder decoder;
+    int priority = classify_block(block, decoder);
+    return priority < 0 ? (int)http_conn::PRIORITY_STATIC : priority;
+}
+
+int http2_session::pending_priority() const{
+    size_t pos = m_preface_received ? 0 : PREFACE_LEN;
+    if(m_closing || m_in.size() < pos || (m_header_stream == 0 && pending_requests() == 0)){
+        return http_conn::PRIORITY_STATIC;
+    }
+    /*还有未收完的头部块时，之后的块依赖它对动态表的修改*/
+    std::string block;
+    if(m_header_stream == 0 && first_header_block(m_in.data() + pos, m_in.size() - pos, block)){
+        int priority = classify_block(block, m_decoder);
+        if(priority >= 0){
+            return priority;
+        }
+    }
+    return m_priority;
+}
+
+/*只做分类，格式错误时停止，错误由process处理*/
+bool http2_session::first_header_block(const char* data, size_t len, std::string& block){
+    bool started = false;
+    size_t pos = 0;
+    while(len - pos >= FRAME_HEADER_LEN){
+        const uint8_t* p = (const uint8_t*)data + pos;
+        uint32_t frame_len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        const uint8_t* payload = p + FRAME_HEADER_LEN;
+        if(frame_len > MAX_FRAME_SIZE || len - pos - FRAME_HEADER_LEN < frame_len){
+            return false;
+        }
+        pos += FRAME_HEADER_LEN + frame_len;
+        if(type == FRAME_HEADERS){
+            uint32_t pad = 0;
+            if(flags & FLAG_PADDED){
+                if(frame_len < 1){
+                    return false;
+                }
+                pad = payload[0];
+                payload ++;
+                frame_len --;
+            }
+            if(flags & FLAG_PRIORITY){
+                if(frame_len < 5){
+                    return false;
+                }
+                payload += 5;
+                frame_len -= 5;
+            }
+            if(pad > frame_len){
+                return false;
+            }
+            block.assign((const char*)payload, frame_len - pad);
+            started = true;
+        }
+        else if(type == FRAME_CONTINUATION && started){
+            if(block.size() + frame_len > MAX_HEADER_BLOCK){
+                return false;
+            }
+            block.append((const char*)payload, frame_len);
+        }
+        else{
+            continue;
+        }
+        if(flags & FLAG_END_HEADERS){
+            return true;
+        }
+    }
+    return false;
+}
+
+int http2_session::classify_block(const std::string& block, const hpack_decoder& decoder){
+    std::string path;
+    if(decoder.find((const uint8_t*)block.data(), block.size(), ":path", path) <= 0){
+        return -1;
+    }
+    return classify_path(path.data(), path.size());
+}
+
+void http2_session::process(){
+    size_t pos = 0;
+    m_batch_priority = -1;
+    if(!m_preface_received){
+        if(m_in.size() < (size_t)PREFACE_LEN){
+            return;
+        }
+        if(memcmp(m_in.data(), CLIENT_PREFACE, PREFACE_LEN) != 0){
+            connection_error(PROTOCOL_ERROR);
+            m_in.clear();
+            return;
+        }
+        m_preface_received = true;
+        pos = PREFACE_LEN;
+    }
+    while(!m_closing && m_in.size() - pos >= FRAME_HEADER_LEN){
+        const uint8_t* p = (const uint8_t*)m_in.data() + pos;
+        uint32_t len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t stream_id = get_u32(p + 5) & 0x7fffffff;
+        if(len > MAX_FRAME_SIZE){
+            connection_error(FRAME_SIZE_ERROR);
+            break;
+        }
+        if(m_in.size() - pos - FRAME_HEADER_LEN < len){
+            break;
+        }
+        pos += FRAME_HEADER_LEN + len;
+        /*连接前言之后的第一个帧必须是SETTINGS*/
+        if(!m_settings_received){
+            if(type != FRAME_SETTINGS || (flags & FLAG_ACK)){
+                connection_error(PROTOCOL_ERROR);
+                break;
+            }
+            m_settings_received = true;
+        }
+        if(!handle_frame(type, flags, stream_id, p + FRAME_HEADER_LEN, len)){
+            break;
+        }
+    }
+    if(m_closing){
+        m_in.clear();
+    }
+    else{
+        m_in.erase(0, pos);
+    }
+    if(m_batch_priority >= 0){
+        m_priority = m_batch_priority;
+    }
+}
+
+bool http2_session::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    /*头部块必须由连续的CONTINUATION帧完成，中间不能插入其他帧*/
+    if(m_header_stream && type != FRAME_CONTINUATION){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    switch(type)
+    {
+        case FRAME_DATA:
+            return handle_data(flags, stream_id, payload, len);
+        case FRAME_HEADERS:
+            return handle_headers(flags, stream_id, payload, len);
+        case FRAME_CONTINUATION:
+            return handle_continuation(flags, stream_id, payload, len);
+        case FRAME_SETTINGS:
+            return handle_settings(flags, stream_id, payload, len);
+        case FRAME_WINDOW_UPDATE:
+            return handle_window_update(stream_id, payload, len);
+        case FRAME_RST_STREAM:
+            return handle_rst_stream(stream_id, payload, len);
+        case FRAME_PING:
+            return handle_ping(flags, stream_id, payload, len);
+        case FRAME_PRIORITY:
+        {
+            /*不实现优先级，所有流轮流发送*/
+            if(stream_id == 0){
+                return connection_error(PROTOCOL_ERROR);
+            }
+            if(len != 5){
+                stream_error(stream_id, FRAME_SIZE_ERROR);
+            }
+            return true;
+        }
+        case FRAME_GOAWAY:
+        {
+            if(stream_id != 0){
+                return connection_error(PROTOCOL_ERROR);
+            }
+            /*对端不再创建新的流，已有的流发送完毕后关闭连接*/
+            m_goaway_received = true;
+            return true;
+        }
+        case FRAME_PUSH_PROMISE:
+            /*客户端不能推送*/
+            return connection_error(PROTOCOL_ERROR);
+        default:
+            /*忽略未知类型的帧*/
+            return true;
+    }
+}
+
+bool http2_session::handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(stream_id == 0){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    uint32_t pad = 0;
+    if(flags & FLAG_PADDED){
+        if(len < 1){
+            return connection_error(FRAME_SIZE_ERROR);
+        }
+        pad = payload[0];
+        payload ++;
+        len --;
+    }
+    if(flags & FLAG_PRIORITY){
+        if(len < 5){
+            return connection_error(FRAME_SIZE_ERROR);
+        }
+        payload += 5;
+        len -= 5;
+    }
+    if(pad > len){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    m_header_block.assign((const char*)payload, len - pad);
+    m_header_stream = stream_id;
+    m_header_end_stream = flags & FLAG_END_STREAM;
+    if(flags & FLAG_END_HEADERS){
+        return end_headers();
+    }
+    return true;
+}
+
+bool http2_session::handle_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(m_header_stream == 0 || stream_id != m_header_stream){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    if(m_header_block.size() + len > MAX_HEADER_BLOCK){
+        return connection_error(ENHANCE_YOUR_CALM);
+    }
+    m_header_block.append((const char*)payload, len);
+    if(flags & FLAG_END_HEADERS){
+        return end_headers();
+    }
+    return true;
+}
+
+bool http2_session::end_headers(){
+    uint32_t stream_id = m_header_stream;
+    bool end_stream = m_header_end_stream;
+    m_header_stream = 0;
+    /*即使流会被拒绝也必须解码，保持动态表与对端同步*/
+    std::vector< hpack_header > headers;
+    if(!m_decoder.decode((const uint8_t*)m_header_block.data(), m_header_block.size(), headers)){
+        return connection_error(COMPRESSION_ERROR);
+    }
+    m_header_block.clear();
+
+    stream* s = find_stream(stream_id);
+    if(s){
+        /*已有流上的HEADERS只能是结束流的trailer*/
+        if(s->remote_closed){
+            stream_error(stream_id, STREAM_CLOSED);
+        }
+        else if(!end_stream){
+            stream_error(stream_id, PROTOCOL_ERROR);
+        }
+        else{
+            s->remote_closed = true;
+            respond(s);
+        }
+        return true;
+    }
+    /*客户端的流ID必须为奇数且单调递增*/
+    if((stream_id & 1) == 0 || stream_id <= m_last_stream_id){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    m_last_stream_id = stream_id;
+    if(m_goaway_received){
+        return true;
+    }
+    /*GOAWAY之后对端新建的流不会被处理，对端可以在其他连接上安全地重试*/
+    if(m_goaway_sent){
+        stream_error(stream_id, REFUSED_STREAM);
+        return true;
+    }
+    if(m_streams.size() >= (size_t)MAX_CONCURRENT_STREAMS){
+        stream_error(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    s = new stream();
+    s->id = stream_id;
+    s->bad_request = false;
+    s->accept_gzip = false;
+    s->send_window = m_peer_initial_window;
+    bool has_method = false;
+    for(size_t i = 0; i < headers.size(); ++ i){
+        const std::string& name = headers[i].name;
+        const std::string& value = headers[i].value;
+        if(name == ":method"){
+            has_method = true;
+            s->bad_request = value != "GET";
+        }
+        else if(name == ":path"){
+            s->path = value;
+        }
+        else if(name == "accept-encoding"){
+            s->accept_gzip = value.find("gzip") != std::string::npos;
+        }
+        else if(name == "if-none-match"){
+            s->if_none_match = value;
+        }
+    }
+    m_streams[stream_id] = s;
+    if(!has_method || s->path.empty()){
+        stream_error(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+    if(s->path[0] != '/'){
+        s->bad_request = true;
+    }
+    else{
+        int priority = classify_path(s->path.data(), s->path.size());
+        if(priority > m_batch_priority){
+            m_batch_priority = priority;
+        }
+    }
+    if(end_stream){
+        s->remote_closed = true;
+        respond(s);
+    }
+    return true;
+}
+
+bool http2_session::handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(stream_id == 0){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    if(flags & FLAG_PADDED){
+        if(len < 1 || payload[0] >= len){
+            return connection_error(PROTOCOL_ERROR);
+        }
+    }
+    /*请求体直接丢弃(只响应GET)，收到后立即归还窗口*/
+    if(len > 0){
+        queue_window_update(0, len);
+    }
+    stream* s = find_stream(stream_id);
+    if(!s){
+        if(stream_id > m_last_stream_id){
+            return connection_error(PROTOCOL_ERROR);
+        }
+        stream_error(stream_id, STREAM_CLOSED);
+        return true;
+    }
+    if(s->remote_closed){
+        stream_error(stream_id, STREAM_CLOSED);
+        return true;
+    }
+    if(flags & FLAG_END_STREAM){
+        s->remote_closed = true;
+        respond(s);
+    }
+    else if(len > 0){
+        queue_window_update(stream_id, len);
+    }
+    return true;
+}
+
+bool http2_session::handle_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(stream_id != 0){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    if(flags & FLAG_ACK){
+        if(len != 0){
+            return connection_error(FRAME_SIZE_ERROR);
+        }
+        return true;
+    }
+    if(len % 6 != 0){
+        return connection_error(FRAME_SIZE_ERROR);
+    }
+    uint32_t code = apply_settings(payload, len);
+    if(code != NO_ERROR){
+        return connection_error(code);
+    }
+    queue_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+uint32_t http2_session::apply_settings(const uint8_t* payload, size_t len){
+    for(size_t i = 0; i + 6 <= len; i += 6){
+        uint16_t id = ((uint16_t)payload[i] << 8) | payload[i + 1];
+        uint32_t value = get_u32(payload + i + 2);
+        switch(id)
+        {
+            case SETTINGS_HEADER_TABLE_SIZE:
+                m_encoder.set_max_table_size(value);
+                break;
+            case SETTINGS_ENABLE_PUSH:
+                if(value > 1){
+                    return PROTOCOL_ERROR;
+                }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if(value > MAX_WINDOW){
+                    return FLOW_CONTROL_ERROR;
+                }
+                /*初始窗口的变化作用于所有已打开的流*/
+                int64_t delta = (int64_t)value - m_peer_initial_window;
+                m_peer_initial_window = value;
+                for(std::map< uint32_t, stream* >::iterator it = m_streams.begin(); it != m_streams.end(); ++ it){
+                    it->second->send_window += delta;
+                    if(it->second->send_window > MAX_WINDOW){
+                        return FLOW_CONTROL_ERROR;
+                    }
+                    /*窗口可能变为负数，此时停止发送，等待WINDOW_UPDATE*/
+                    if(it->second->send_window <= 0 && it->second->sending){
+                        m_sending.remove(it->second);
+                        it->second->sending = false;
+                    }
+                    resume(it->second);
+                }
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if(value < MAX_FRAME_SIZE || value > 0xffffff){
+                    return PROTOCOL_ERROR;
+                }
+                m_peer_max_frame = value;
+                break;
+            default:
+                break;
+        }
+    }
+    return NO_ERROR;
+}
+
+bool http2_session::handle_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(len != 4){
+        return connection_error(FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = get_u32(payload) & 0x7fffffff;
+    if(stream_id == 0){
+        if(increment == 0){
+            return connection_error(PROTOCOL_ERROR);
+        }
+        m_conn_send_window += increment;
+        if(m_conn_send_window > MAX_WINDOW){
+            return connection_error(FLOW_CONTROL_ERROR);
+        }
+        return true;
+    }
+    stream* s = find_stream(stream_id);
+    if(!s){
+        return true;
+    }
+    if(increment == 0){
+        stream_error(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+    s->send_window += increment;
+    if(s->send_window > MAX_WINDOW){
+        stream_error(stream_id, FLOW_CONTROL_ERROR);
+        return true;
+    }
+    resume(s);
+    return true;
+}
+
+bool http2_session::handle_rst_stream(uint32_t stream_id, const uint8_t* /*payload*/, uint32_t len){
+    if(stream_id == 0){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    if(len != 4){
+        return connection_error(FRAME_SIZE_ERROR);
+    }
+    stream* s = find_stream(stream_id);
+    if(s){
+        close_stream(s);
+    }
+    else if(stream_id > m_last_stream_id){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    return true;
+}
+
+bool http2_session::handle_ping(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len){
+    if(stream_id != 0){
+        return connection_error(PROTOCOL_ERROR);
+    }
+    if(len != 8){
+        return connection_error(FRAME_SIZE_ERROR);
+    }
+    if(!(flags & FLAG_ACK)){
+        queue_frame(FRAME_PING, FLAG_ACK, 0, (const char*)payload, len);
+    }
+    /*在此之前对端发起的流都已经收到，发送带有最终last-stream-id的GOAWAY*/
+    else if(m_shutdown_started && !m_goaway_sent && memcmp(payload, SHUTDOWN_PING, sizeof(SHUTDOWN_PING)) == 0){
+        queue_goaway(m_last_stream_id, NO_ERROR);
+        m_goaway_sent = true;
+    }
+    return true;
+}
+
+void http2_session::respond(stream* s){
+    http_conn::HTTP_CODE code = http_conn::BAD_REQUEST;
+    if(!s->bad_request){
+        code = http_conn::resolve(s->path.c_str(), s->accept_gzip,
+                                  s->if_none_match.empty() ? NULL : s->if_none_match.c_str(), &s->file);
+    }
+    const char* status;
+    s->body = NULL;
+    s->body_left = 0;
+    switch(code)
+    {
+        case http_conn::FILE_REQUEST:
+            status = "200";
+            if(s->file.st.st_size != 0){
+                s->body = s->file.address;
+                s->body_left = s->file.st.st_size;
+            }
+            else{
+                s->body = "<html><body></body></html>";
+                s->body_left = strlen(s->body);
+            }
+            break;
+        case http_conn::HEALTH_REQUEST:
+            status = "200";
+            s->body = ok_health_form;
+            s->body_left = strlen(ok_health_form);
+            break;
+        case http_conn::NOT_MODIFIED:
+            status = "304";
+            break;
+        case http_conn::NO_RESOURCE:
+            status = "404";
+            s->body = error_404_form;
+            s->body_left = strlen(error_404_form);
+            break;
+        case http_conn::FORBIDDEN_REQUEST:
+            status = "403";
+            s->body = error_403_form;
+            s->body_left = strlen(error_403_form);
+            break;
+        case http_conn::BAD_REQUEST:
+            status = "400";
+            s->body = error_400_form;
+            s->body_left = strlen(error_400_form);
+            break;
+        default:
+            status = "500";
+            s->body = error_500_form;
+            s->body_left = strlen(error_500_form);
+            break;
+    }
+
+    /*重复出现的字段加入动态表，同一连接上后续响应的这些字段只需一个字节*/
+    std::string block;
+    char length[24];
+    snprintf(length, sizeof(length), "%zu", s->body_left);
+    m_encoder.begin(block);
+    m_encoder.encode(":status", status, true, block);
+    m_encoder.encode("content-length", length, false, block);
+    if(s->file.pack_entry && (code == http_conn::FILE_REQUEST || code == http_conn::NOT_MODIFIED)){
+        m_encoder.encode("content-type", s->file.pack->content_type(s->file.pack_entry), true, block);
+        m_encoder.encode("etag", s->file.etag(), false, block);
+        if(s->file.pack_entry->gzip_size != 0){
+            m_encoder.encode("vary", "accept-encoding", true, block);
+        }
+        if(s->file.pack_gzip){
+            m_encoder.encode("content-encoding", "gzip", true, block);
+        }
+    }
+
+    /*头部块超过对端的最大帧长度时拆分为HEADERS和若干CONTINUATION*/
+    uint8_t end_stream = s->body_left == 0 ? FLAG_END_STREAM : 0;
+    size_t offset = 0;
+    do{
+        size_t n = block.size() - offset;
+        if(n > m_peer_max_frame){
+            n = m_peer_max_frame;
+        }
+        uint8_t flags = offset + n == block.size() ? FLAG_END_HEADERS : 0;
+        if(offset == 0){
+            queue_frame(FRAME_HEADERS, flags | end_stream, s->id, block.data(), n);
+        }
+        else{
+            queue_frame(FRAME_CONTINUATION, flags, s->id, block.data() + offset, n);
+        }
+        offset += n;
+    }while(offset < block.size());
+
+    if(end_stream){
+        s->local_closed = true;
+        try_close(s);
+    }
+    else{
+        resume(s);
+    }
+}
+
+void http2_session::pump(){
+    /*升级时先只发送101和响应头，等收到客户端的连接前言后再发送DATA，
+      避免客户端在切换协议前就要缓存大量数据*/
+    if(!m_settings_received){
+        return;
+    }
+    while(!m_closing && !m_sending.empty() && m_conn_send_window > 0 && m_out_bytes < OUTPUT_HIGH_WATER){
+        stream* s = m_sending.front();
+        m_sending.pop_front();
+        if(s->send_window <= 0){
+            s->sending = false;
+            continue;
+        }
+        size_t n = s->body_left;
+        if(n > m_peer_max_frame){
+            n = m_peer_max_frame;
+        }
+        if((int64_t)n > m_conn_send_window){
+            n = m_conn_send_window;
+        }
+        if((int64_t)n > s->send_window){
+            n = s->send_window;
+        }
+        bool end_stream = n == s->body_left;
+        queue_data(s, n, end_stream);
+        s->body += n;
+        s->body_left -= n;
+        s->send_window -= n;
+        m_conn_send_window -= n;
+        if(end_stream){
+            s->sending = false;
+            s->local_closed = true;
+            try_close(s);
+        }
+        else if(s->send_window > 0){
+            /*放到队尾，与其他流轮流发送*/
+            m_sending.push_back(s);
+        }
+        else{
+            /*等待该流的WINDOW_UPDATE*/
+            s->sending = false;
+        }
+    }
+}
+
+void http2_session::queue_raw(const char* data, size_t len){
+    chunk c;
+    c.head.assign(data, len);
+    c.data = NULL;
+    c.len = 0;
+    c.owner = NULL;
+    m_out_bytes += len;
+    m_out.push_back(c);
+}
+
+void http2_session::queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t len){
+    char head[FRAME_HEADER_LEN];
+    put_frame_header(head, len, type, flags, stream_id);
+    queue_raw(head, FRAME_HEADER_LEN);
+    if(len){
+        m_out.back().head.append(payload, len);
+        m_out_bytes += len;
+    }
+}
+
+void http2_session::queue_data(stream* s, size_t len, bool end_stream){
+    chunk c;
+    c.head.resize(FRAME_HEADER_LEN);
+    put_frame_header(&c.head[0], len, FRAME_DATA, end_stream ? FLAG_END_STREAM : 0, s->id);
+    c.data = s->body;
+    c.len = len;
+    c.owner = s;
+    s->pending ++;
+    m_out_bytes += c.head.size() + len;
+    m_out.push_back(c);
+}
+
+void http2_session::queue_goaway(uint32_t last_stream_id, uint32_t code){
+    char payload[8];
+    put_u32(payload, last_stream_id);
+    put_u32(payload + 4, code);
+    queue_frame(FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+void http2_session::queue_window_update(uint32_t stream_id, uint32_t increment){
+    char payload[4];
+    put_u32(payload, increment & 0x7fffffff);
+    queue_frame(FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+http2_session::stream* http2_session::find_stream(uint32_t stream_id){
+    std::map< uint32_t, stream* >::iterator it = m_streams.find(stream_id);
+    return it == m_streams.end() ? NULL : it->second;
+}
+
+void http2_session::resume(stream* s){
+    if(!s->sending && !s->local_closed && s->body_left > 0 && s->send_window > 0 && s->remote_closed){
+        s->sending = true;
+        m_sending.push_back(s);
+    }
+}
+
+void http2_session::try_close(stream* s){
+    if(s->remote_closed && s->local_closed){
+        close_stream(s);
+    }
+}
+
+void http2_session::close_stream(stream* s){
+    if(s->sending){
+        m_sending.remove(s);
+        s->sending = false;
+    }
+    m_streams.erase(s->id);
+    s->detached = true;
+    release_stream(s);
+}
+
+void http2_session::release_stream(stream* s){
+    if(s->detached && s->pending == 0){
+        s->file.release();
+        delete s;
+    }
+}
+
+void http2_session::stream_error(uint32_t stream_id, uint32_t code){
+    char payload[4];
+    put_u32(payload, code);
+    queue_frame(FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+    stream* s = find_stream(stream_id);
+    if(s){
+        close_stream(s);
+    }
+}
+
+/*RFC 9113 6.8：先发送last-stream-id为2^31-1的GOAWAY通知对端不要再发起新的流，
+  并用PING测量一个往返，收到ACK后再发送真正的last-stream-id，避免拒绝已经在路上的请求*/
+void http2_session::shutdown(){
+    if(m_shutdown_started || m_goaway_sent || m_closing){
+        return;
+    }
+    queue_goaway(0x7fffffff, NO_ERROR);
+    queue_frame(FRAME_PING, 0, 0, SHUTDOWN_PING, sizeof(SHUTDOWN_PING));
+    m_shutdown_started = true;
+}
+
+void http2_session::abort(uint32_t code){
+    if(!m_closing){
+        connection_error(code);
+    }
+}
+
+bool http2_session::connection_error(uint32_t code){
+    queue_goaway(m_last_stream_id, code);
+    m_closing = true;
+    return false;
+}
+
+int http2_session::prepare_iov(struct iovec* iov, int max){
+    pump();
+    int count = 0;
+    size_t offset = m_out_offset;
+    for(std::deque< chunk >::iterator it = m_out.begin(); it != m_out.end() && count < max; ++ it){
+        if(offset < it->head.size()){
+            iov[count].iov_base = (void*)(it->head.data() + offset);
+            iov[count].iov_len = it->head.size() - offset;
+            count ++;
+            offset = 0;
+        }
+        else{
+            offset -= it->head.size();
+        }
+        if(it->len && count < max){
+            iov[count].iov_base = (void*)(it->data + offset);
+            iov[count].iov_len = it->len - offset;
+            count ++;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+void http2_session::consume(size_t len){
+    m_out_bytes -= len;
+    while(len > 0 && !m_out.empty()){
+        chunk& c = m_out.front();
+        size_t left = c.head.size() + c.len - m_out_offset;
+        if(len < left){
+            m_out_offset += len;
+            return;
+        }
+        len -= left;
+        stream* s = c.owner;
+        m_out.pop_front();
+        m_out_offset = 0;
+        if(s){
+            s->pending --;
+            release_stream(s);
+        }
+    }
+}
+
+bool http2_session::want_write(){
+    pump();
+    return !m_out.empty();
+}
+
+bool http2_session::should_close() const{
+    return m_out.empty() && (m_closing || ((m_goaway_received || m_goaway_sent) && m_streams.empty()));
+}
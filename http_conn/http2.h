@@ -0,0 +1,200 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+
+#include "hpack.h"
+#include "http_conn.h"
+
+/*HTTP/2(明文h2c)会话，一个连接上的所有流共享一个http_conn。
+  会话本身不做IO：http_conn把读到的数据交给buffer_input，由process解析；
+  待发送的帧通过prepare_iov/consume交给http_conn用writev发送，DATA帧直接引用mmap的文件内容*/
+class http2_session{
+public:
+    /*客户端连接前言的长度*/
+    static const int PREFACE_LEN = 24;
+    /*本端允许的最大并发流数量*/
+    static const int MAX_CONCURRENT_STREAMS = 128;
+    /*本端接受的最大帧长度(SETTINGS_MAX_FRAME_SIZE的默认值)*/
+    static const uint32_t MAX_FRAME_SIZE = 16384;
+    /*流控窗口的初始值及上限*/
+    static const int32_t DEFAULT_WINDOW = 65535;
+    static const int64_t MAX_WINDOW = 0x7fffffff;
+    /*头部块(HEADERS+CONTINUATION)的最大长度*/
+    static const size_t MAX_HEADER_BLOCK = 64 * 1024;
+    /*发送队列中的数据超过该值时暂停生成DATA帧*/
+    static const size_t OUTPUT_HIGH_WATER = 256 * 1024;
+
+    /*帧类型*/
+    enum FRAME_TYPE{FRAME_DATA = 0, FRAME_HEADERS, FRAME_PRIORITY, FRAME_RST_STREAM,
+                    FRAME_SETTINGS, FRAME_PUSH_PROMISE, FRAME_PING, FRAME_GOAWAY,
+                    FRAME_WINDOW_UPDATE, FRAME_CONTINUATION};
+    /*帧标志*/
+    enum FRAME_FLAG{FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4,
+                    FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20};
+    /*SETTINGS参数*/
+    enum SETTING{SETTINGS_HEADER_TABLE_SIZE = 1, SETTINGS_ENABLE_PUSH, SETTINGS_MAX_CONCURRENT_STREAMS,
+                 SETTINGS_INITIAL_WINDOW_SIZE, SETTINGS_MAX_FRAME_SIZE, SETTINGS_MAX_HEADER_LIST_SIZE};
+    /*错误码*/
+    enum ERROR_CODE{NO_ERROR = 0, PROTOCOL_ERROR, INTERNAL_ERROR, FLOW_CONTROL_ERROR,
+                    SETTINGS_TIMEOUT, STREAM_CLOSED, FRAME_SIZE_ERROR, REFUSED_STREAM,
+                    CANCEL, COMPRESSION_ERROR, CONNECT_ERROR, ENHANCE_YOUR_CALM};
+
+public:
+    http2_session();
+    ~http2_session();
+    /*判断数据是否以客户端连接前言开头：是返回1，不是返回0，数据不足无法判断返回-1*/
+    static int check_preface(const char* data, size_t len);
+    /*统计data(从帧边界开始)中完整的HEADERS帧数量，即其中新请求的数量*/
+    static int count_requests(const char* data, size_t len);
+    /*发送服务器的SETTINGS，以连接前言开始的连接(prior knowledge)调用*/
+    void start();
+    /*处理HTTP/1.1的Upgrade: h2c。先发送101响应和SETTINGS，应用HTTP2-Settings，
+      并把升级前的请求作为流1响应；HTTP2-Settings非法时返回false，此时不应升级*/
+    bool upgrade(const char* settings, const char* url, bool accept_gzip, const char* if_none_match);
+    /*保存从socket读到的数据*/
+    void buffer_input(const char* data, size_t len);
+    /*已缓存但还未处理的新请求数量，process会处理所有完整的帧，所以每个请求只被统计一次*/
+    int pending_requests() const;
+    /*按:path估计data(从帧边界开始)中第一个完整头部块的代价，返回http_conn::PRIORITY_CLASS，
+      没有请求时返回PRIORITY_STATIC；用于会话还未创建时，连接前言之后已经带有请求的情况*/
+    static int classify_requests(const char* data, size_t len);
+    /*未处理的请求的代价，没有请求时返回PRIORITY_STATIC，主线程在append之前调用。
+      只在动态表上查找第一个头部块的:path，不复制也不修改解码器；无法确定时沿用上一次process处理的请求中最高的类别*/
+    int pending_priority() const;
+    /*解析已缓存的数据并处理所有完整的帧*/
+    void process();
+    /*填充待发送的数据，返回iovec的数量，0表示没有待发送的数据*/
+    int prepare_iov(struct iovec* iov, int max);
+    /*writev成功写出了len字节*/
+    void consume(size_t len);
+    /*是否有数据等待发送*/
+    bool want_write();
+    /*连接是否应该关闭：发生了连接错误或者任意一端GOAWAY后所有流都已结束，并且数据都已发出*/
+    bool should_close() const;
+    /*优雅关闭：分两步发送GOAWAY(先2^31-1，对端确认PING后再发送最终的last-stream-id)，
+      之后不再接受新的流，已有的流发送完毕后关闭连接。可以重复调用*/
+    void shutdown();
+    /*以错误码code立即结束会话(发送GOAWAY)，用于会话之外的原因，例如客户端超出限速*/
+    void abort(uint32_t code);
+
+private:
+    /*一个流*/
+    struct stream{
+        uint32_t id;
+        /*对端已经发送END_STREAM*/
+        bool remote_closed;
+        /*本端已经排队了带END_STREAM的帧*/
+        bool local_closed;
+        /*已经从m_streams中移除，等发送队列中不再引用它时释放*/
+        bool detached;
+        /*是否在m_sending中*/
+        bool sending;
+        /*请求信息*/
+        bool bad_request;
+        bool accept_gzip;
+        std::string path;
+        std::string if_none_match;
+        /*响应的目标文件及剩余的响应体*/
+        http_file file;
+        const char* body;
+        size_t body_left;
+        int64_t send_window;
+        /*发送队列中引用该流的数据块数量*/
+        int pending;
+    };
+    /*发送队列中的一块数据：head为帧头或者整个控制帧，data指向流的响应体(不拥有)*/
+    struct chunk{
+        std::string head;
+        const char* data;
+        size_t len;
+        stream* owner;
+    };
+
+private:
+    bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_continuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_window_update(uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_rst_stream(uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    bool handle_ping(uint8_t flags, uint32_t stream_id, const uint8_t* payload, uint32_t len);
+    /*取出data(从帧边界开始)中第一个完整的头部块，去掉填充和优先级字段；没有时返回false*/
+    static bool first_header_block(const char* data, size_t len, std::string& block);
+    /*按头部块中的:path分类，无法确定时返回-1*/
+    static int classify_block(const std::string& block, const hpack_decoder& decoder);
+    /*头部块接收完整后解码并创建流*/
+    bool end_headers();
+    /*应用对端的SETTINGS，出错时返回错误码*/
+    uint32_t apply_settings(const uint8_t* payload, size_t len);
+    /*生成流的响应头，并把响应体加入发送轮转*/
+    void respond(stream* s);
+    /*在窗口和发送队列允许的范围内，轮流为各个流生成DATA帧*/
+    void pump();
+    /*不加帧头直接排队，用于101响应*/
+    void queue_raw(const char* data, size_t len);
+    void queue_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const char* payload, size_t len);
+    void queue_data(stream* s, size_t len, bool end_stream);
+    void queue_goaway(uint32_t last_stream_id, uint32_t code);
+    void queue_window_update(uint32_t stream_id, uint32_t increment);
+    stream* find_stream(uint32_t stream_id);
+    /*流的发送窗口变为正数时恢复发送*/
+    void resume(stream* s);
+    /*两端都已结束时关闭流*/
+    void try_close(stream* s);
+    /*从会话中移除流，发送队列中不再引用它时释放*/
+    void close_stream(stream* s);
+    void release_stream(stream* s);
+    /*流错误：发送RST_STREAM并关闭流*/
+    void stream_error(uint32_t stream_id, uint32_t code);
+    /*连接错误：发送GOAWAY，之后不再处理任何帧*/
+    bool connection_error(uint32_t code);
+
+private:
+    /*尚未解析的输入*/
+    std::string m_in;
+    bool m_preface_received;
+    bool m_settings_received;
+    hpack_decoder m_decoder;
+    hpack_encoder m_encoder;
+
+    std::map< uint32_t, stream* > m_streams;
+    /*有响应体等待发送且窗口可用的流，轮流发送*/
+    std::list< stream* > m_sending;
+    uint32_t m_last_stream_id;
+
+    /*正在接收的头部块，m_header_stream为0表示没有*/
+    std::string m_header_block;
+    uint32_t m_header_stream;
+    bool m_header_end_stream;
+    /*process按:path计算的请求类别，与m_in一样由主线程和工作线程按顺序访问；
+      m_batch_priority为本次process中的最高类别，-1表示没有新请求*/
+    int m_priority;
+    int m_batch_priority;
+
+    /*连接级的发送窗口，以及对端通告的流初始窗口和最大帧长度*/
+    int64_t m_conn_send_window;
+    int64_t m_peer_initial_window;
+    uint32_t m_peer_max_frame;
+
+    /*发送队列，m_out_offset为队首数据块已经发出的字节数*/
+    std::deque< chunk > m_out;
+    size_t m_out_offset;
+    size_t m_out_bytes;
+
+    /*已发送GOAWAY(连接错误)，已收到对端的GOAWAY，以及本端已优雅关闭(发送了最终的GOAWAY)*/
+    bool m_closing;
+    bool m_goaway_received;
+    bool m_goaway_sent;
+    /*已发送last-stream-id为2^31-1的GOAWAY，等待PING的ACK*/
+    bool m_shutdown_started;
+};
+
+#endif
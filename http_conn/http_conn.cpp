@@ -1,15 +1,24 @@
 #include "http_conn.h"
+#include "http2.h"
+#include "websocket.h"
 #include <iostream>
 
 
 /*定义HTTP响应的状态信息*/
+const char* ok_101_title = "Switching Protocols";
 const char* ok_200_title = "OK";
+const char* ok_304_title = "Not Modified";
+const char* ok_health_form = "ok\n";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file  from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_426_title = "Upgrade Required";
+const char* error_426_form = "Only version 13 of the WebSocket protocol is supported.\n";
+const char* error_429_title = "Too Many Requests";
+const char* error_429_form = "You have sent too many requests in a given amount of time.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
 
@@ -45,13 +54,50 @@ void modfd(int epollfd, int fd, int ev){
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
+/*判断逗号分隔的选项列表(例如Connection: keep-alive, Upgrade)中是否有token，不区分大小写*/
+static bool has_token(const char* list, const char* token){
+    size_t len = strlen(token);
+    while(*list){
+        list += strspn(list, " \t,");
+        size_t n = strcspn(list, ",");
+        size_t end = n;
+        while(end > 0 && (list[end - 1] == ' ' || list[end - 1] == '\t')){
+            end --;
+        }
+        if(end == len && strncasecmp(list, token, len) == 0){
+            return true;
+        }
+        list += n;
+    }
+    return false;
+}
+
 /*初始化当前连接的用户数量以及事件注册表*/
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+docpack* http_conn::m_docpack = NULL;
+docindex* http_conn::m_docindex = NULL;
+const char* http_conn::m_health_url = "/health";
+tls_context* http_conn::m_tls = NULL;
+std::atomic< bool > http_conn::m_draining(false);
+ratelimit* http_conn::m_ratelimit = NULL;
+websocket_hub* http_conn::m_websocket = NULL;
 
 /*关闭服务器上搭载的连接之一*/
 void http_conn::close_conn(bool real_close){
     if(real_close && (m_sockfd != -1)){
+        unmap();
+        if(m_h2){
+            delete m_h2;
+            m_h2 = NULL;
+        }
+        /*退订之后其他线程不会再写这个socket，发送线程可能还持有引用，由引用计数释放*/
+        if(m_ws){
+            m_ws->detach();
+            m_ws->release();
+            m_ws = NULL;
+        }
+        m_tls_conn.close();
         removefd(m_epollfd, m_sockfd);
         /*设置己方sockfd为-1*/
         m_sockfd = -1; 
@@ -69,14 +115,29 @@ void http_conn::init(int sockfd, const sockaddr_in& addr){
     int reuse = 1;
     setsockpt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     */
+    m_processing = false;
+    m_drain_state = DRAIN_NONE;
     addfd(m_epollfd, sockfd, true);
     m_user_count ++;
     init();
+    if(m_tls && !m_tls_conn.attach(m_tls, sockfd)){
+        close_conn();
+    }
 }
 /*初始化HTTP请求的相关参数*/
 void http_conn::init(){
     m_check_state = CHECK_STATE_REQUESTLINE;
+    m_admitted = false;
     m_linger = false;
+    m_accept_gzip = false;
+    m_if_none_match = 0;
+    m_upgrade_h2c = false;
+    m_h2_settings = 0;
+    m_upgrade_websocket = false;
+    m_connection_upgrade = false;
+    m_ws_key = 0;
+    m_ws_version = 0;
+    m_file = http_file();
 
     m_method = GET;
     m_url = 0;
@@ -87,9 +148,9 @@ void http_conn::init(){
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    m_bytes_to_send = 0;
     memset(m_read_buf, '\0', sizeof(m_read_buf));
     memset(m_write_buf, '\0', sizeof(m_write_buf));
-    memset(m_real_file, '\0', sizeof(m_real_file));
 }
 
 
@@ -103,9 +164,9 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             if( (m_checked_idx + 1) == m_read_idx){
                 return LINE_OPEN;
             }
-            else if(m_read_buf[m_read_idx + 1] == '\n'){
-                m_read_buf[m_read_idx ++] = '\0';
-                m_read_buf[m_read_idx ++] = '\0';
+            else if(m_read_buf[m_checked_idx + 1] == '\n'){
+                m_read_buf[m_checked_idx ++] = '\0';
+                m_read_buf[m_checked_idx ++] = '\0';
                 return LINE_OK;
             }
             return LINE_BAD;
@@ -119,7 +180,7 @@ http_conn::LINE_STATUS http_conn::parse_line(){
             return LINE_BAD;
         }
     }
-    return LINE_BAD;
+    return LINE_OPEN;
 }
 /*从状态机，解析请求行, 获得解决方法，目标URL，以及HTTP版本号*/
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
@@ -180,9 +241,10 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text){
     else if(strncasecmp(text, "Connection:", 11) == 0){
         text += 11;
         text += strspn(text, " \t");
-        if(strcasecmp(text, "keep-alive") == 0){
+        if(has_token(text, "keep-alive")){
             m_linger = true;
         }
+        m_connection_upgrade = has_token(text, "upgrade");
     }
     /*处理content-length头部字段*/
     else if(strncasecmp(text, "Content-Length:", 15) == 0){
@@ -196,6 +258,41 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text){
         text += strspn(text, " \t");
         m_host = text;
     }
+    /*处理Accept-Encoding头部字段，只关心是否接受gzip*/
+    else if(strncasecmp(text, "Accept-Encoding:", 16) == 0){
+        text += 16;
+        text += strspn(text, " \t");
+        m_accept_gzip = strstr(text, "gzip") != NULL;
+    }
+    /*处理If-None-Match头部字段*/
+    else if(strncasecmp(text, "If-None-Match:", 14) == 0){
+        text += 14;
+        text += strspn(text, " \t");
+        m_if_none_match = text;
+    }
+    /*处理Upgrade和HTTP2-Settings头部字段，支持升级到h2c和WebSocket*/
+    else if(strncasecmp(text, "Upgrade:", 8) == 0){
+        text += 8;
+        text += strspn(text, " \t");
+        m_upgrade_h2c = strcasecmp(text, "h2c") == 0;
+        m_upgrade_websocket = strcasecmp(text, "websocket") == 0;
+    }
+    else if(strncasecmp(text, "HTTP2-Settings:", 15) == 0){
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
+    }
+    /*处理WebSocket握手的头部字段*/
+    else if(strncasecmp(text, "Sec-WebSocket-Key:", 18) == 0){
+        text += 18;
+        text += strspn(text, " \t");
+        m_ws_key = text;
+    }
+    else if(strncasecmp(text, "Sec-WebSocket-Version:", 22) == 0){
+        text += 22;
+        text += strspn(text, " \t");
+        m_ws_version = text;
+    }
     else{
         std::cout << "oop! unknow header " << text << std::endl;
     }
@@ -269,12 +366,37 @@ http_conn::HTTP_CODE http_conn::process_read(){
 
 /*循环读取客户数据，直到无数据可读或者对方关闭连接*/
 bool http_conn::read(){
+    m_processing = true;
+    /*TLS握手由工作线程在process中进行，主线程只把事件交给线程池*/
+    if(handshaking()){
+        return true;
+    }
+    if(m_ws){
+        return m_ws->read();
+    }
+    /*HTTP/2连接的数据全部交给会话缓存*/
+    if(m_h2){
+        while(true){
+            int bytes_read = recv_data(m_read_buf, READ_BUFFER_SIZE);
+            if(bytes_read == -1){
+                if(errno == EAGAIN || errno == EWOULDBLOCK){
+                    break;
+                }
+                return false;
+            }
+            else if(bytes_read == 0){
+                return false;
+            }
+            m_h2->buffer_input(m_read_buf, bytes_read);
+        }
+        return true;
+    }
     if(m_read_idx >= READ_BUFFER_SIZE){
         return false;
     }
     int bytes_read = 0;
     while(true){
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv_data(m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
         /*对应读取失败的情况*/
         if(bytes_read == -1){
             if(errno == EAGAIN || errno == EWOULDBLOCK){
@@ -292,50 +414,280 @@ bool http_conn::read(){
 }
 
 
-/*分析HTTP请求目标文件的属性，如果该文件存在、对所有用户可见且不是目录，则
-使用mmap将该文件映射到m_file_address处*/
+/*只查看请求行中的URL，不修改读缓冲区：健康检查单独一类；
+归档命中、索引中确定不存在的路径以及小文件都是廉价请求；其余请求可能需要读取大文件，归为高代价请求*/
+int http_conn::classify(){
+    /*握手需要签名和密钥交换，与读取大文件一样归为高代价*/
+    if(handshaking()){
+        return PRIORITY_HEAVY;
+    }
+    if(m_h2){
+        return m_h2->pending_priority();
+    }
+    if(http2_session::check_preface(m_read_buf, m_read_idx) > 0){
+        return http2_session::classify_requests(m_read_buf + http2_session::PREFACE_LEN,
+                                                m_read_idx - http2_session::PREFACE_LEN);
+    }
+    char* end = (char*)memchr(m_read_buf, '\n', m_read_idx);
+    /*请求行还不完整，处理时只会继续等待数据*/
+    if(!end){
+        return PRIORITY_STATIC;
+    }
+    char* url = (char*)memchr(m_read_buf, ' ', end - m_read_buf);
+    if(!url){
+        return PRIORITY_STATIC;
+    }
+    url ++;
+    char* url_end = url;
+    while(url_end < end && *url_end != ' ' && *url_end != '?' && *url_end != '\r'){
+        url_end ++;
+    }
+    return classify_url(url, url_end - url);
+}
+int http_conn::classify_url(const char* url, size_t len){
+    if(m_health_url && strlen(m_health_url) == len && memcmp(url, m_health_url, len) == 0){
+        return PRIORITY_HEALTH;
+    }
+    if(m_docpack){
+        return PRIORITY_STATIC;
+    }
+    if(m_docindex){
+        docindex_entry entry;
+        docindex::LOOKUP_RESULT found = m_docindex->lookup(url, len, &entry);
+        if(found == docindex::NOT_FOUND ||
+           (found == docindex::FOUND && (S_ISDIR(entry.mode) || entry.size <= SMALL_FILE_SIZE))){
+            return PRIORITY_STATIC;
+        }
+    }
+    return PRIORITY_HEAVY;
+}
+
+
+/*在主线程中直接拒绝，超出限速的请求不会占用工作线程。
+只尝试写一次，socket暂时不可写时客户端收不到429，但连接同样被关闭*/
+bool http_conn::admit(){
+    /*WebSocket连接上客户端的消息不计数，握手请求本身已经计过*/
+    if(!m_ratelimit || m_ws || handshaking()){
+        return true;
+    }
+    int requests = 1;
+    if(m_h2){
+        requests = m_h2->pending_requests();
+    }
+    else{
+        /*请求行不完整时等它完整后再计数，避免慢速客户端的一个请求被计多次*/
+        if(m_admitted || !memchr(m_read_buf, '\n', m_read_idx)){
+            return true;
+        }
+        m_admitted = true;
+        if(http2_session::check_preface(m_read_buf, m_read_idx) > 0){
+            requests = http2_session::count_requests(m_read_buf + http2_session::PREFACE_LEN,
+                                                     m_read_idx - http2_session::PREFACE_LEN);
+        }
+    }
+    /*只有控制帧(SETTINGS、WINDOW_UPDATE等)的HTTP/2数据不计数*/
+    if(requests == 0 || m_ratelimit->allow(m_address.sin_addr.s_addr, requests)){
+        return true;
+    }
+    if(m_h2){
+        m_h2->abort(http2_session::ENHANCE_YOUR_CALM);
+        write_h2();
+    }
+    else{
+        m_linger = false;
+        add_status_line(429, error_429_title);
+        add_response("Retry-After: 1\r\n");
+        add_headers(strlen(error_429_form));
+        add_content(error_429_form);
+        struct iovec iv;
+        iv.iov_base = m_write_buf;
+        iv.iov_len = m_write_idx;
+        send_data(&iv, 1);
+    }
+    close_conn();
+    return false;
+}
+
+
+/*分析HTTP请求目标文件的属性*/
 http_conn::HTTP_CODE http_conn::do_request(){
-    strcpy(m_real_file, doc_root);
+    /*客户端请求升级到h2c(RFC 7540 3.2)，本次请求在升级后作为流1响应*/
+    if(m_upgrade_h2c && m_h2_settings){
+        return UPGRADE_REQUEST;
+    }
+    /*WebSocket握手(RFC 6455 4.2)，没有配置发布中心时忽略Upgrade，按普通请求处理*/
+    if(m_upgrade_websocket && m_websocket){
+        if(m_method != GET || !m_connection_upgrade || !m_ws_version ||
+           !m_ws_key || !websocket_session::valid_key(m_ws_key)){
+            return BAD_REQUEST;
+        }
+        /*不支持的版本回复426，并通过Sec-WebSocket-Version告知支持的版本*/
+        if(strcmp(m_ws_version, "13") != 0){
+            return UPGRADE_REQUIRED;
+        }
+        return WEBSOCKET_REQUEST;
+    }
+    return resolve(m_url, m_accept_gzip, m_if_none_match, &m_file);
+}
+/*分析url对应的目标文件的属性，如果该文件存在、对所有用户可见且不是目录，则
+使用mmap将该文件映射到file->address处。HTTP/1.1连接和HTTP/2的流共用*/
+http_conn::HTTP_CODE http_conn::resolve(const char* url, bool accept_gzip, const char* if_none_match, http_file* file){
+    /*查询字符串不属于文件路径*/
+    int url_len = strcspn(url, "?");
+    if(m_health_url && (int)strlen(m_health_url) == url_len && strncmp(url, m_health_url, url_len) == 0){
+        return HEALTH_REQUEST;
+    }
+    if(m_docpack){
+        return resolve_pack(url, url_len, accept_gzip, if_none_match, file);
+    }
+    char real_file[FILENAME_LEN];
+    strcpy(real_file, doc_root);
     int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    /*捕获文件信息到m_file_stat，成功返回0， 失败返回-1*/
-    if(stat(m_real_file, &m_file_stat) < 0){
-        return NO_REQUEST;
+    int copy_len = url_len;
+    if(copy_len > FILENAME_LEN - len - 1){
+        copy_len = FILENAME_LEN - len - 1;
+    }
+    strncpy(real_file + len, url, copy_len);
+    real_file[len + copy_len] = '\0';
+    /*优先查询元数据索引，索引中不存在的路径直接返回404，不再访问文件系统*/
+    docindex::LOOKUP_RESULT found = docindex::UNKNOWN;
+    if(m_docindex){
+        docindex_entry entry;
+        found = m_docindex->lookup(url, url_len, &entry);
+        if(found == docindex::NOT_FOUND){
+            return NO_RESOURCE;
+        }
+        if(found == docindex::FOUND){
+            file->st.st_ino = entry.ino;
+            file->st.st_size = entry.size;
+            file->st.st_mtime = entry.mtime;
+            file->st.st_mode = entry.mode;
+        }
+    }
+    /*捕获文件信息到file->st，成功返回0， 失败返回-1*/
+    if(found != docindex::FOUND && stat(real_file, &file->st) < 0){
+        return NO_RESOURCE;
     }
     /*该文件模式为其他组读权限时*/
-    if(!(m_file_stat.st_mode & S_IROTH)){
+    if(!(file->st.st_mode & S_IROTH)){
         return FORBIDDEN_REQUEST;
     }
     /*该文件为目录时*/
-    if(S_ISDIR(m_file_stat.st_mode)){
+    if(S_ISDIR(file->st.st_mode)){
         return BAD_REQUEST;
     }
     /*将请求的该文件以只读方式映射进内存*/
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int fd = open(real_file, O_RDONLY);
+    if(fd < 0){
+        return NO_RESOURCE;
+    }
+    /*索引中的信息可能落后于尚未处理的inotify事件，映射前以fstat为准，避免映射超出文件末尾；
+      权限和类型也要按fstat的结果重新检查*/
+    if(found == docindex::FOUND){
+        if(fstat(fd, &file->st) < 0){
+            close(fd);
+            return INTERNAL_ERROR;
+        }
+        if(!(file->st.st_mode & S_IROTH)){
+            close(fd);
+            return FORBIDDEN_REQUEST;
+        }
+        if(S_ISDIR(file->st.st_mode)){
+            close(fd);
+            return BAD_REQUEST;
+        }
+    }
+    file->address = (char*)mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if(file->address == MAP_FAILED){
+        file->address = 0;
+        return file->st.st_size == 0 ? FILE_REQUEST : INTERNAL_ERROR;
+    }
     return FILE_REQUEST;
 }
-/*释放共享内存*/
-void http_conn::unmap(){
-    if(m_file_address){
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+/*在归档中查找目标文件，一次哈希查找，不产生任何文件系统调用*/
+http_conn::HTTP_CODE http_conn::resolve_pack(const char* url, int url_len, bool accept_gzip,
+                                             const char* if_none_match, http_file* file){
+    file->pack = m_docpack->acquire();
+    if(!file->pack){
+        return INTERNAL_ERROR;
+    }
+    file->pack_entry = file->pack->lookup(url, url_len);
+    if(!file->pack_entry){
+        file->pack->put();
+        file->pack = 0;
+        return NO_RESOURCE;
+    }
+    if(!(file->pack_entry->mode & S_IROTH)){
+        return FORBIDDEN_REQUEST;
+    }
+    file->pack_gzip = accept_gzip && file->pack_entry->gzip_size != 0;
+    /*与将要发送的版本的ETag比较*/
+    if(if_none_match && strcmp(if_none_match, file->etag()) == 0){
+        return NOT_MODIFIED;
     }
+    if(file->pack_gzip){
+        file->address = (char*)file->pack->gzip_data(file->pack_entry);
+        file->st.st_size = file->pack_entry->gzip_size;
+    }
+    else{
+        file->address = (char*)file->pack->data(file->pack_entry);
+        file->st.st_size = file->pack_entry->data_size;
+    }
+    file->st.st_mode = file->pack_entry->mode;
+    file->st.st_mtime = file->pack_entry->mtime;
+    return FILE_REQUEST;
+}
+/*释放共享内存，文件来自归档时只释放对归档的引用*/
+void http_file::release(){
+    if(pack){
+        pack->put();
+        pack = 0;
+        pack_entry = 0;
+        pack_gzip = false;
+        address = 0;
+    }
+    else if(address){
+        munmap(address, st.st_size);
+        address = 0;
+    }
+}
+void http_conn::unmap(){
+    m_file.release();
 }
 
 bool http_conn::write(){
+    /*drain注册的EPOLLOUT由这里处理，之后工作线程照常注册事件*/
+    if(m_draining){
+        m_drain_state = DRAIN_DONE;
+    }
+    /*握手期间的EPOLLOUT应当交给线程池，这里只可能是drain注册的EPOLLOUT：还没有请求，直接关闭*/
+    if(handshaking()){
+        return false;
+    }
+    if(m_h2){
+        return write_h2();
+    }
+    if(m_ws){
+        return write_ws();
+    }
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
-    if(bytes_to_send == 0){
+    if(m_bytes_to_send == 0){
+        /*由drain触发：关闭空闲的keep-alive连接，已经收到一部分的请求照常处理*/
+        if(m_draining){
+            if(m_read_idx == 0){
+                return false;
+            }
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            return true;
+        }
         modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
         return true;
     }
     while(1){
         /*成功时temp为写的总字数，失败时temp为-1*/
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = send_data(m_iv, m_iv_count);
         /*如果写操作失败*/
         if(temp <= -1){
             /*此处EAGAIN表示缓冲区不可写
@@ -349,12 +701,11 @@ bool http_conn::write(){
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if(bytes_to_send <= bytes_have_send){
+        m_bytes_to_send -= temp;
+        if(m_bytes_to_send <= 0){
             unmap();
             /*更具connection字段的值来判断是否保持连接*/
-            if(m_linger){
+            if(m_linger && !m_draining){
                 init();
                 modfd(m_epollfd, m_sockfd, EPOLLIN);
                 return true;
@@ -364,6 +715,59 @@ bool http_conn::write(){
                 return false;
             }
         }
+        /*只写出了一部分，调整iovec使下次从未发送的位置继续*/
+        if((size_t)temp >= m_iv[0].iov_len){
+            temp -= m_iv[0].iov_len;
+            m_iv[0].iov_len = 0;
+            m_iv[1].iov_base = (char*)m_iv[1].iov_base + temp;
+            m_iv[1].iov_len -= temp;
+        }
+        else{
+            m_iv[0].iov_base = (char*)m_iv[0].iov_base + temp;
+            m_iv[0].iov_len -= temp;
+        }
+    }
+}
+/*启用kTLS时send_data仍然直接writev到socket，由内核加密*/
+ssize_t http_conn::recv_data(char* buf, size_t len){
+    if(m_tls_conn.active()){
+        return m_tls_conn.read(buf, len);
+    }
+    return recv(m_sockfd, buf, len, 0);
+}
+ssize_t http_conn::send_data(const struct iovec* iov, int count){
+    if(m_tls_conn.active()){
+        return m_tls_conn.writev(m_sockfd, iov, count);
+    }
+    return writev(m_sockfd, iov, count);
+}
+bool http_conn::handshaking() const{
+    return m_tls_conn.active() && !m_tls_conn.established();
+}
+/*发送HTTP/2会话中排队的帧，DATA帧直接引用文件内容*/
+bool http_conn::write_h2(){
+    struct iovec iv[64];
+    if(m_draining){
+        m_h2->shutdown();
+    }
+    while(true){
+        int count = m_h2->prepare_iov(iv, 64);
+        if(count == 0){
+            if(m_h2->should_close()){
+                return false;
+            }
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            return true;
+        }
+        int temp = send_data(iv, count);
+        if(temp <= -1){
+            if(errno == EAGAIN){
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        m_h2->consume(temp);
     }
 }
 /*往写缓冲中写入待发送的数据*/
@@ -394,9 +798,26 @@ bool http_conn::add_status_line(int status, const char* title){
 }
 /*将各类信息组成头文件*/
 bool http_conn::add_headers(int content_len){
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_linger() && add_blank_line();
+}
+/*写入归档中预先计算好的头部信息*/
+bool http_conn::add_pack_headers(){
+    if(!m_file.pack_entry){
+        return true;
+    }
+    if(!add_response("Content-Type: %s\r\n", m_file.pack->content_type(m_file.pack_entry)) ||
+       !add_response("ETag: %s\r\n", m_file.etag())){
+        return false;
+    }
+    if(m_file.pack_entry->gzip_size != 0){
+        if(!add_response("Vary: Accept-Encoding\r\n")){
+            return false;
+        }
+    }
+    if(m_file.pack_gzip){
+        return add_response("Content-Encoding: gzip\r\n");
+    }
+    return true;
 }
 bool http_conn::add_content_length(int content_len){
     return add_response("Content-Length: %d\r\n", content_len);
@@ -415,6 +836,9 @@ bool http_conn::add_content(const char* content){
 }
 /*根据请求，决定返回的内容*/
 bool http_conn::process_write(HTTP_CODE ret){
+    if(m_draining){
+        m_linger = false;
+    }
     switch(ret)
     {
         case INTERNAL_ERROR:
@@ -435,6 +859,18 @@ bool http_conn::process_write(HTTP_CODE ret){
             }
             break;
         }
+        case UPGRADE_REQUIRED:
+        {
+            add_status_line(426, error_426_title);
+            if(!add_response("Sec-WebSocket-Version: 13\r\n")){
+                return false;
+            }
+            add_headers(strlen(error_426_form));
+            if(! add_content(error_426_form)){
+                return false;
+            }
+            break;
+        }
         case NO_RESOURCE:
         {
             add_status_line(404, error_404_title);
@@ -453,16 +889,43 @@ bool http_conn::process_write(HTTP_CODE ret){
             }
             break;
         }
+        case HEALTH_REQUEST:
+        {
+            add_status_line(200, ok_200_title);
+            add_headers(strlen(ok_health_form));
+            if(! add_content(ok_health_form)){
+                return false;
+            }
+            break;
+        }
+        case WEBSOCKET_REQUEST:
+        {
+            add_status_line(101, ok_101_title);
+            if(!add_response("Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n",
+                             websocket_session::accept_key(m_ws_key).c_str()) || !add_blank_line()){
+                return false;
+            }
+            break;
+        }
+        case NOT_MODIFIED:
+        {
+            add_status_line(304, ok_304_title);
+            add_pack_headers();
+            add_headers(0);
+            break;
+        }
         case FILE_REQUEST:
         {
             add_status_line(200, ok_200_title);
-            if(m_file_stat.st_size != 0){
-                add_headers(m_file_stat.st_size);
+            add_pack_headers();
+            if(m_file.st.st_size != 0){
+                add_headers(m_file.st.st_size);
                 m_iv[0].iov_base = m_write_buf;
                 m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
+                m_iv[1].iov_base = m_file.address;
+                m_iv[1].iov_len = m_file.st.st_size;
                 m_iv_count = 2;
+                m_bytes_to_send = m_write_idx + m_file.st.st_size;
                 return true;
             }
             else{
@@ -472,6 +935,7 @@ bool http_conn::process_write(HTTP_CODE ret){
                     return false;
                 }
             }
+            break;
         }
         default:
         {
@@ -481,19 +945,135 @@ bool http_conn::process_write(HTTP_CODE ret){
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
     m_iv_count = 1;
+    m_bytes_to_send = m_write_idx;
     return true;
 }
 
 
 void http_conn::process(){
+    /*TLS握手：签名和密钥交换在工作线程中进行。握手完成时客户端的请求可能已经到达，
+      重新注册EPOLLIN时epoll会立即报告*/
+    if(handshaking()){
+        if(m_draining || m_tls_conn.handshake() == tls_conn::HANDSHAKE_ERROR){
+            close_conn();
+            return;
+        }
+        rearm(m_tls_conn.want_write() ? EPOLLOUT : EPOLLIN);
+        return;
+    }
+    if(m_h2){
+        process_h2();
+        return;
+    }
+    if(m_ws){
+        process_ws();
+        return;
+    }
+    /*以HTTP/2连接前言开头的连接直接使用HTTP/2(prior knowledge)*/
+    int preface = http2_session::check_preface(m_read_buf, m_read_idx);
+    if(preface < 0){
+        rearm(EPOLLIN);
+        return;
+    }
+    if(preface > 0){
+        m_h2 = new http2_session();
+        m_h2->start();
+        m_h2->buffer_input(m_read_buf, m_read_idx);
+        m_read_idx = 0;
+        process_h2();
+        return;
+    }
     HTTP_CODE read_ret = process_read();
     if(read_ret == NO_REQUEST){
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
         return;
     }
+    if(read_ret == UPGRADE_REQUEST){
+        m_h2 = new http2_session();
+        if(m_h2->upgrade(m_h2_settings, m_url, m_accept_gzip, m_if_none_match)){
+            /*请求之后已经读入的数据属于HTTP/2*/
+            m_h2->buffer_input(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+            m_read_idx = 0;
+            process_h2();
+            return;
+        }
+        /*HTTP2-Settings不合法时不升级，按HTTP/1.1响应*/
+        delete m_h2;
+        m_h2 = NULL;
+        read_ret = resolve(m_url, m_accept_gzip, m_if_none_match, &m_file);
+    }
     bool write_ret = process_write(read_ret);
     if(! write_ret){
         close_conn();
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
-}
\ No newline at end of file
+    else if(read_ret == WEBSOCKET_REQUEST){
+        /*101响应由会话发送，之后订阅频道，推送的帧只会排在它后面*/
+        m_ws = new websocket_session(this, m_sockfd, m_websocket, m_url, m_write_buf, m_write_idx);
+        m_ws->buffer_input(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+        m_read_idx = 0;
+        m_write_idx = 0;
+        m_websocket->subscribe(m_ws);
+        m_ws->flush();
+        process_ws();
+        return;
+    }
+    rearm(EPOLLOUT);
+}
+/*先清除m_processing再检查m_draining，与drain中相反的顺序保证二者至少有一方看到对方：
+  工作线程看到m_draining时改为注册EPOLLOUT，由主线程的write完成drain；drain已经抢先注册了EPOLLOUT时不再注册*/
+void http_conn::rearm(int ev){
+    int sockfd = m_sockfd;
+    m_processing = false;
+    if(m_draining){
+        int state = DRAIN_NONE;
+        if(!m_drain_state.compare_exchange_strong(state, DRAIN_DONE) && state == DRAIN_ARMED){
+            return;
+        }
+        ev = EPOLLOUT;
+    }
+    modfd(m_epollfd, sockfd, ev);
+}
+void http_conn::drain(){
+    if(m_processing || m_sockfd == -1){
+        return;
+    }
+    int state = DRAIN_NONE;
+    if(m_drain_state.compare_exchange_strong(state, DRAIN_ARMED)){
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    }
+}
+/*WebSocket连接只在需要关闭时关注EPOLLOUT，其余的发送由会话和websocket_hub的发送线程完成*/
+void http_conn::process_ws(){
+    if(m_draining){
+        m_ws->close(websocket_session::CLOSE_GOING_AWAY);
+    }
+    m_ws->process();
+    rearm(m_ws->finished() ? EPOLLOUT : EPOLLIN);
+}
+bool http_conn::write_ws(){
+    if(m_draining){
+        m_ws->close(websocket_session::CLOSE_GOING_AWAY);
+    }
+    if(!m_ws->flush()){
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+        return true;
+    }
+    /*关闭握手完成后才关闭TCP连接；本端先发送关闭帧时继续读取，等待对方的关闭帧*/
+    if(m_ws->finished()){
+        return false;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+    return true;
+}
+void http_conn::process_h2(){
+    if(m_draining){
+        m_h2->shutdown();
+    }
+    m_h2->process();
+    if(m_h2->want_write() || m_h2->should_close()){
+        rearm(EPOLLOUT);
+    }
+    else{
+        rearm(EPOLLIN);
+    }
+}
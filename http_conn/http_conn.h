@@ -19,7 +19,36 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <atomic>
 #include "locker.h"
+#include "docpack.h"
+#include "docindex.h"
+#include "tls.h"
+#include "ratelimit.h"
+
+class http2_session;
+class websocket_session;
+class websocket_hub;
+
+/*静态文件请求的处理结果：目标文件被mmap到内存中，或者指向docpack归档内部。
+  HTTP/1.1连接和HTTP/2的每个流各持有一个*/
+struct http_file{
+    /*文件内容在内存中的起始位置*/
+    char* address;
+    /*目标文件的状态*/
+    struct stat st;
+    /*文件来自归档时持有归档的引用，address指向归档内部*/
+    docpack_archive* pack;
+    const docpack_entry* pack_entry;
+    /*是否发送预压缩版本*/
+    bool pack_gzip;
+
+    http_file(): address(0), pack(0), pack_entry(0), pack_gzip(false){}
+    /*实际发送的版本的ETag*/
+    const char* etag() const { return pack_gzip ? pack_entry->gzip_etag : pack_entry->etag; }
+    /*解除映射或者释放对归档的引用*/
+    void release();
+};
 
 class http_conn{
 
@@ -30,6 +59,8 @@ public:
     static const int READ_BUFFER_SIZE = 2048;
     /*写缓冲区大小*/
     static const int WRITE_BUFFER_SIZE = 1024;
+    /*不超过该大小的文件被视为廉价的静态请求*/
+    static const int SMALL_FILE_SIZE = 64 * 1024;
     /*HTTP请求方法*/
     enum METHOD{ GET = 0, POST, HEAD, PUT, DELETE,
                 TRACE, OPTIONS, CONNECT, PATCH};
@@ -40,15 +71,23 @@ public:
                      CHECK_STATE_CONTENT};
     /*服务器处理结果：NO_REQUEST表示请求不完整，需要继续读取客户数据；GET_REQUEST表示获得了一个完整的客户端请求；
 BAD_REQUEST表示客户请求有语法错误；FORBIDDEN_REQUEST表示客户对资源没有足够的访问权限；INTERNAL_ERROR表示服务器内部错误；
- CLOSE_CONNECTION表示客户端已关闭连接*/
+ CLOSE_CONNECTION表示客户端已关闭连接；NOT_MODIFIED表示客户端缓存的版本(If-None-Match)仍然有效；HEALTH_REQUEST表示健康检查请求；
+ UPGRADE_REQUEST表示客户端请求升级到HTTP/2(h2c)；WEBSOCKET_REQUEST表示合法的WebSocket握手；
+ UPGRADE_REQUIRED表示WebSocket版本不受支持*/
     enum HTTP_CODE{NO_REQUEST, GET_REQUEST, BAD_REQUEST,
                    NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST,
-                   INTERNAL_ERROR, CLOSED_CONNECTION};
+                   INTERNAL_ERROR, CLOSED_CONNECTION, NOT_MODIFIED, HEALTH_REQUEST,
+                   UPGRADE_REQUEST, WEBSOCKET_REQUEST, UPGRADE_REQUIRED};
     /*从状态机三种状态，读取完整一行，行出错，行数据读取不完整*/
     enum LINE_STATUS{LINE_OK = 0, LINE_BAD, LINE_OPEN};
+    /*请求在线程池中的优先级类别：健康检查；廉价的静态请求(归档命中、小文件、404)；其余代价较高的请求*/
+    enum PRIORITY_CLASS{PRIORITY_HEALTH = 0, PRIORITY_STATIC,
+                        PRIORITY_HEAVY, PRIORITY_CLASS_COUNT};
+    /*drain的进度：尚未处理，主线程已经注册了EPOLLOUT，已经由write或者工作线程处理*/
+    enum DRAIN_STATE{DRAIN_NONE = 0, DRAIN_ARMED, DRAIN_DONE};
 
 public:
-    http_conn(){}
+    http_conn(): m_h2(NULL), m_ws(NULL){}
     ~http_conn(){}
 
 public:
@@ -62,6 +101,22 @@ public:
     bool read();
     /*非阻塞写操作*/
     bool write();
+    /*TLS握手是否还在进行。握手在工作线程的process中完成，主线程收到EPOLLOUT时如果返回true，
+      应当与EPOLLIN一样处理(read之后交给线程池)而不是调用write；握手期间read不读取数据*/
+    bool handshaking() const;
+    /*根据已读入的请求行(HTTP/2为尚未处理的各个请求)估计请求的代价，返回PRIORITY_CLASS，主线程在append之前调用*/
+    int classify();
+    /*按URL(不含查询字符串)估计一个请求的代价，HTTP/1.1和HTTP/2共用*/
+    static int classify_url(const char* url, size_t len);
+    /*按客户端地址限速，主线程在read之后、append之前调用：HTTP/1.1在请求行完整时计一个请求，
+      HTTP/2按新到达的HEADERS帧计数。超出限速时直接回复429(HTTP/2发送GOAWAY(ENHANCE_YOUR_CALM))并关闭连接，
+      返回false，此时不应再append*/
+    bool admit();
+    /*平滑重启：设置m_draining之后主线程对每个活跃连接调用一次。空闲的连接注册EPOLLOUT，由write关闭空闲的keep-alive连接、
+      向HTTP/2连接发送GOAWAY、向WebSocket连接发送关闭帧；正在由工作线程处理的连接在处理完之后同样交给write*/
+    void drain();
+    /*解析url对应的静态文件并填充file，HTTP/1.1和HTTP/2共用*/
+    static HTTP_CODE resolve(const char* url, bool accept_gzip, const char* if_none_match, http_file* file);
 
 private:
     /*初始化连接*/
@@ -70,6 +125,17 @@ private:
     HTTP_CODE process_read();
     /*填充HTTP应答*/
     bool process_write(HTTP_CODE ret);
+    /*读写socket，启用TLS时经过tls_conn，约定与recv/writev相同*/
+    ssize_t recv_data(char* buf, size_t len);
+    ssize_t send_data(const struct iovec* iov, int count);
+    /*工作线程处理完毕后重新注册事件，之后连接可能立即被主线程处理*/
+    void rearm(int ev);
+    /*切换到HTTP/2之后的处理和写操作*/
+    void process_h2();
+    bool write_h2();
+    /*切换到WebSocket之后的处理和写操作*/
+    void process_ws();
+    bool write_ws();
 
     /*以下函数供process_read调用来分析HTTP请求*/
     HTTP_CODE parse_request_line(char* text);
@@ -93,17 +159,44 @@ private:
     bool add_content_length(int content_line);
     bool add_linger();
     bool add_blank_line();
+    /*往写缓冲中写入来自归档的Content-Type、ETag以及Content-Encoding*/
+    bool add_pack_headers();
+    /*在归档中查找请求的文件*/
+    static HTTP_CODE resolve_pack(const char* url, int url_len, bool accept_gzip,
+                                  const char* if_none_match, http_file* file);
 
 public:
     /*设置为静态变量是因为所有socket上的事件*/
     static int m_epollfd;
     /*用户数量*/
     static int m_user_count;
+    /*docroot归档，不为NULL时直接从归档中响应静态文件，不再访问文件系统*/
+    static docpack* m_docpack;
+    /*docroot元数据索引，不为NULL时用它代替stat，并直接对不存在的路径返回404*/
+    static docindex* m_docindex;
+    /*健康检查的URL，服务器直接应答而不访问文件*/
+    static const char* m_health_url;
+    /*TLS配置，不为NULL时所有连接都先进行TLS握手*/
+    static tls_context* m_tls;
+    /*平滑重启时旧进程停止accept后设置，之后对每个连接调用drain：HTTP/1.1响应后关闭连接，HTTP/2连接发送GOAWAY，已有的请求照常完成*/
+    static std::atomic< bool > m_draining;
+    /*按客户端地址及子网限速，NULL表示不限速*/
+    static ratelimit* m_ratelimit;
+    /*WebSocket的发布中心，不为NULL时接受WebSocket握手，连接订阅以请求路径为名的频道*/
+    static websocket_hub* m_websocket;
 
 private:
     /*该HTTP连接的socket和对方的socket地址*/
     int m_sockfd;
     sockaddr_in m_address;
+    /*当前请求是否已经通过了限速检查*/
+    bool m_admitted;
+    /*连接是否已经交给工作线程(read时设置，rearm时清除)以及drain的进度，
+      用于drain与工作线程之间的同步，保证只有一方为连接注册EPOLLOUT*/
+    std::atomic< bool > m_processing;
+    std::atomic< int > m_drain_state;
+    /*连接的TLS状态，未启用TLS时不活跃*/
+    tls_conn m_tls_conn;
 
 
 
@@ -133,8 +226,6 @@ private:
 
 
 
-    /*客户请求的目标文件的完整路径*/
-    char m_real_file[FILENAME_LEN];
     /*客户请求目标文件文件名*/
     char* m_url;
     /*HTTP协议版本号*/
@@ -145,12 +236,23 @@ private:
     int m_content_length;
     /*HTTP请求是否保持连接*/
     bool m_linger;
+    /*客户端是否接受gzip编码*/
+    bool m_accept_gzip;
+    /*If-None-Match头部字段的值*/
+    char* m_if_none_match;
+    /*是否请求升级到h2c，以及HTTP2-Settings头部字段的值*/
+    bool m_upgrade_h2c;
+    char* m_h2_settings;
+    /*是否请求升级到WebSocket，以及Sec-WebSocket-Key和Sec-WebSocket-Version头部字段的值*/
+    bool m_upgrade_websocket;
+    /*Connection头部中是否有Upgrade选项*/
+    bool m_connection_upgrade;
+    char* m_ws_key;
+    char* m_ws_version;
 
 
-    /*客户请求的目标文件被mmap到内存中的起始位置*/
-    char* m_file_address;
-    /*目标文件的状态*/
-    struct stat m_file_stat;
+    /*客户请求的目标文件*/
+    http_file m_file;
     /*采用writev来执行写操作*/
 
     /*struct iovec{
@@ -162,6 +264,14 @@ private:
     struct iovec m_iv[2];
     //m_iv_count是m_iv内含的缓冲区个数
     int m_iv_count;
+    /*响应中还未发送的字节数*/
+    int m_bytes_to_send;
+
+    /*连接切换到HTTP/2之后的会话，NULL表示HTTP/1.1*/
+    http2_session* m_h2;
+    /*连接切换到WebSocket之后的会话，它在其他线程中也通过recv_data/send_data读写socket*/
+    websocket_session* m_ws;
+    friend class websocket_session;
 
 };
 
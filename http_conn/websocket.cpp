@@ -0,0 +1,777 @@
+#include "websocket.h"
+#include "http_conn.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*握手时与Sec-WebSocket-Key拼接的GUID(RFC 6455 1.3)*/
+static const char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+/*控制帧载荷的最大长度*/
+static const size_t MAX_CONTROL_PAYLOAD = 125;
+/*一次读取的大小*/
+static const size_t READ_CHUNK = 4096;
+
+/*SHA-1，只用于计算Sec-WebSocket-Accept，不依赖OpenSSL*/
+static uint32_t rotl(uint32_t x, int n){
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t* h, const uint8_t* block){
+    uint32_t w[80];
+    for(int i = 0; i < 16; i ++){
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for(int i = 16; i < 80; i ++){
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for(int i = 0; i < 80; i ++){
+        uint32_t f, k;
+        if(i < 20){
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if(i < 40){
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if(i < 60){
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else{
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void sha1(const std::string& data, uint8_t* digest){
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string padded = data;
+    padded += (char)0x80;
+    while(padded.size() % 64 != 56){
+        padded += (char)0;
+    }
+    uint64_t bits = (uint64_t)data.size() * 8;
+    for(int i = 7; i >= 0; i --){
+        padded += (char)(bits >> (i * 8));
+    }
+    for(size_t i = 0; i < padded.size(); i += 64){
+        sha1_block(h, (const uint8_t*)padded.data() + i);
+    }
+    for(int i = 0; i < 5; i ++){
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+    }
+}
+
+static std::string base64(const uint8_t* data, size_t len){
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for(size_t i = 0; i < len; i += 3){
+        uint32_t n = (uint32_t)data[i] << 16;
+        if(i + 1 < len){
+            n |= (uint32_t)data[i + 1] << 8;
+        }
+        if(i + 2 < len){
+            n |= data[i + 2];
+        }
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+        out += i + 2 < len ? table[n & 63] : '=';
+    }
+    return out;
+}
+
+/*state保存当前字符还缺少的字节数以及下一个字节的取值范围。连续的ASCII每次检查8字节*/
+bool websocket_session::utf8_check(const uint8_t* p, size_t len, uint32_t* state){
+    uint32_t need = *state & 0xff;
+    uint32_t lower = (*state >> 8) & 0xff;
+    uint32_t upper = (*state >> 16) & 0xff;
+    size_t i = 0;
+    while(i < len){
+        uint8_t c = p[i ++];
+        if(need != 0){
+            if(c < lower || c > upper){
+                return false;
+            }
+            need --;
+            lower = 0x80;
+            upper = 0xbf;
+            continue;
+        }
+        if(c < 0x80){
+            for(uint64_t v; i + 8 <= len; i += 8){
+                memcpy(&v, p + i, 8);
+                if(v & 0x8080808080808080ull){
+                    break;
+                }
+            }
+            continue;
+        }
+        /*排除超长编码、代理对以及大于U+10FFFF的码点*/
+        lower = 0x80;
+        upper = 0xbf;
+        if(c >= 0xc2 && c <= 0xdf){
+            need = 1;
+        }
+        else if(c >= 0xe0 && c <= 0xef){
+            need = 2;
+            if(c == 0xe0){
+                lower = 0xa0;
+            }
+            else if(c == 0xed){
+                upper = 0x9f;
+            }
+        }
+        else if(c >= 0xf0 && c <= 0xf4){
+            need = 3;
+            if(c == 0xf0){
+                lower = 0x90;
+            }
+            else if(c == 0xf4){
+                upper = 0x8f;
+            }
+        }
+        else{
+            return false;
+        }
+    }
+    *state = need == 0 ? 0 : need | (lower << 8) | (upper << 16);
+    return true;
+}
+
+/*1004-1006和1015是保留值，不能出现在帧中*/
+bool websocket_session::valid_close_code(uint16_t code){
+    return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+}
+
+websocket_frame* websocket_frame::allocate(size_t size){
+    void* memory = malloc(sizeof(websocket_frame) + size);
+    if(!memory){
+        throw std::bad_alloc();
+    }
+    websocket_frame* frame = new (memory) websocket_frame();
+    frame->m_refs.store(1, std::memory_order_relaxed);
+    frame->m_size = size;
+    frame->m_data = (char*)(frame + 1);
+    return frame;
+}
+
+websocket_frame* websocket_frame::create(uint8_t opcode, const char* payload, size_t len){
+    size_t head = len < 126 ? 2 : (len < 65536 ? 4 : 10);
+    websocket_frame* frame = allocate(head + len);
+    uint8_t* p = (uint8_t*)frame->m_data;
+    p[0] = 0x80 | opcode;
+    if(len < 126){
+        p[1] = len;
+    }
+    else if(len < 65536){
+        p[1] = 126;
+        p[2] = len >> 8;
+        p[3] = len;
+    }
+    else{
+        p[1] = 127;
+        for(int i = 0; i < 8; i ++){
+            p[2 + i] = (uint64_t)len >> ((7 - i) * 8);
+        }
+    }
+    memcpy(p + head, payload, len);
+    return frame;
+}
+
+websocket_frame* websocket_frame::create_raw(const char* data, size_t len){
+    websocket_frame* frame = allocate(len);
+    memcpy(frame->m_data, data, len);
+    return frame;
+}
+
+void websocket_frame::release(){
+    if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        this->~websocket_frame();
+        free(this);
+    }
+}
+
+std::string websocket_session::accept_key(const char* key){
+    uint8_t digest[20];
+    sha1(std::string(key) + WEBSOCKET_GUID, digest);
+    return base64(digest, sizeof(digest));
+}
+
+/*16字节编码后是22个字符加两个'='*/
+bool websocket_session::valid_key(const char* key){
+    if(strlen(key) != 24 || key[22] != '=' || key[23] != '='){
+        return false;
+    }
+    for(int i = 0; i < 22; i ++){
+        char c = key[i];
+        if(!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/')){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*载荷从0开始，每次处理的长度都是4的倍数，所以掩码不需要旋转：先用SSE2每次处理16字节，再每次8字节，最后逐字节*/
+void websocket_session::unmask(char* data, size_t len, const uint8_t* key){
+    uint32_t key32;
+    memcpy(&key32, key, 4);
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i key128 = _mm_set1_epi32(key32);
+    for(; i + 16 <= len; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, key128));
+    }
+#endif
+    uint64_t key64 = ((uint64_t)key32 << 32) | key32;
+    for(; i + 8 <= len; i += 8){
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= key64;
+        memcpy(data + i, &v, 8);
+    }
+    for(; i < len; i ++){
+        data[i] ^= key[i & 3];
+    }
+}
+
+websocket_session::websocket_session(http_conn* conn, int sockfd, websocket_hub* hub, const char* url,
+                                     const char* response, size_t len):
+m_refs(1), m_conn(conn), m_sockfd(sockfd), m_hub(hub), m_channel(url, strcspn(url, "?")), m_index(0),
+m_head_offset(0), m_queued(len), m_detached(false), m_evicted(false), m_close_sent(false),
+m_message_opcode(0), m_utf8_state(0), m_close_received(false){
+    m_queue.push_back(websocket_frame::create_raw(response, len));
+}
+
+websocket_session::~websocket_session(){
+    drop_queue();
+}
+
+void websocket_session::release(){
+    if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
+/*未处理的数据超过一条最大消息时暂停读取，process处理之后重新注册EPOLLIN时epoll会再次报告剩余的数据*/
+bool websocket_session::read(){
+    char buf[READ_CHUNK];
+    while(m_in.size() < 2 * MAX_MESSAGE){
+        m_lock.lock();
+        ssize_t bytes_read = m_conn->recv_data(buf, sizeof(buf));
+        m_lock.unlock();
+        if(bytes_read == -1){
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        else if(bytes_read == 0){
+            return false;
+        }
+        m_in.append(buf, bytes_read);
+    }
+    return true;
+}
+
+void websocket_session::buffer_input(const char* data, size_t len){
+    m_in.append(data, len);
+}
+
+void websocket_session::process(){
+    size_t pos = 0;
+    while(!m_close_received && m_in.size() - pos >= 2){
+        uint8_t* p = (uint8_t*)&m_in[pos];
+        size_t avail = m_in.size() - pos;
+        bool fin = p[0] & 0x80;
+        uint8_t opcode = p[0] & 0x0f;
+        uint64_t len = p[1] & 0x7f;
+        size_t head = 2;
+        if(len == 126){
+            if(avail < 4){
+                break;
+            }
+            len = ((uint64_t)p[2] << 8) | p[3];
+            head = 4;
+        }
+        else if(len == 127){
+            if(avail < 10){
+                break;
+            }
+            len = 0;
+            for(int i = 0; i < 8; i ++){
+                len = (len << 8) | p[2 + i];
+            }
+            head = 10;
+        }
+        /*客户端的帧必须带掩码，不支持扩展(RSV位必须为0)；控制帧不能分片，载荷不超过125字节*/
+        if((p[0] & 0x70) || !(p[1] & 0x80) || (opcode >= OP_CLOSE && (!fin || len > MAX_CONTROL_PAYLOAD))){
+            fail(CLOSE_PROTOCOL_ERROR);
+            return;
+        }
+        /*在等待载荷之前检查长度，过长的消息不会被缓存*/
+        if(opcode < OP_CLOSE && len > MAX_MESSAGE - m_message.size()){
+            fail(CLOSE_TOO_BIG);
+            return;
+        }
+        if(avail - head < 4 + len){
+            break;
+        }
+        char* payload = (char*)p + head + 4;
+        unmask(payload, len, p + head);
+        pos += head + 4 + len;
+        if(!handle_frame(opcode, fin, payload, len)){
+            return;
+        }
+    }
+    m_in.erase(0, pos);
+}
+
+/*返回false表示连接出错，已经发送了关闭帧*/
+bool websocket_session::handle_frame(uint8_t opcode, bool fin, const char* payload, size_t len){
+    switch(opcode)
+    {
+        case OP_TEXT:
+        case OP_BINARY:
+        case OP_CONTINUATION:
+        {
+            /*分片消息中间不能开始新的消息，也不能有不属于任何消息的续帧*/
+            if((opcode == OP_CONTINUATION) == (m_message_opcode == 0)){
+                fail(CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+            if(opcode != OP_CONTINUATION){
+                m_message_opcode = opcode;
+            }
+            /*文本消息必须是合法的UTF-8，每个分片到达时就检查，尽早拒绝*/
+            if(m_message_opcode == OP_TEXT &&
+               (!utf8_check((const uint8_t*)payload, len, &m_utf8_state) || (fin && m_utf8_state != 0))){
+                fail(CLOSE_INVALID_DATA);
+                return false;
+            }
+            if(!fin){
+                m_message.append(payload, len);
+                return true;
+            }
+            websocket_hub::message_handler handler = m_hub->handler();
+            if(handler){
+                if(m_message.empty()){
+                    handler(m_channel, payload, len, m_message_opcode == OP_BINARY);
+                }
+                else{
+                    m_message.append(payload, len);
+                    handler(m_channel, m_message.data(), m_message.size(), m_message_opcode == OP_BINARY);
+                }
+            }
+            m_message.clear();
+            m_message_opcode = 0;
+            m_utf8_state = 0;
+            return true;
+        }
+        case OP_PING:
+        {
+            websocket_frame* pong = websocket_frame::create(OP_PONG, payload, len);
+            send(pong);
+            pong->release();
+            return true;
+        }
+        case OP_PONG:
+            return true;
+        case OP_CLOSE:
+        {
+            /*回应对方合法的状态码；已经发送过关闭帧时这是对方的回应，之后关闭连接。
+              非法的状态码以1002回应，关闭原因必须是合法的UTF-8*/
+            uint16_t code = CLOSE_NORMAL;
+            if(len >= 2){
+                code = ((uint8_t)payload[0] << 8) | (uint8_t)payload[1];
+            }
+            if(len == 1 || (len >= 2 && !valid_close_code(code))){
+                fail(CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+            uint32_t state = 0;
+            if(len > 2 && (!utf8_check((const uint8_t*)payload + 2, len - 2, &state) || state != 0)){
+                fail(CLOSE_INVALID_DATA);
+                return false;
+            }
+            m_close_received = true;
+            close(code);
+            return true;
+        }
+        default:
+        {
+            fail(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+    }
+}
+
+void websocket_session::fail(uint16_t code){
+    m_in.clear();
+    m_close_received = true;
+    close(code);
+}
+
+bool websocket_session::send(websocket_frame* frame){
+    m_lock.lock();
+    if(m_detached || m_evicted || m_close_sent){
+        m_lock.unlock();
+        return false;
+    }
+    /*慢速连接：关闭socket让主线程的epoll报告挂断，由正常的关闭流程释放连接*/
+    if(m_queued + frame->size() > m_hub->queue_limit()){
+        m_evicted = true;
+        drop_queue();
+        shutdown(m_sockfd, SHUT_RDWR);
+        m_lock.unlock();
+        return false;
+    }
+    frame->acquire();
+    m_queue.push_back(frame);
+    m_queued += frame->size();
+    /*队列原来不为空时，已经有人在等待socket可写*/
+    if(m_queue.size() == 1){
+        flush_locked();
+    }
+    m_lock.unlock();
+    return true;
+}
+
+bool websocket_session::flush(){
+    m_lock.lock();
+    bool done = flush_locked();
+    m_lock.unlock();
+    return done;
+}
+
+bool websocket_session::flush_locked(){
+    if(m_detached){
+        return true;
+    }
+    while(!m_queue.empty()){
+        struct iovec iv[IOV_COUNT];
+        int count = 0;
+        size_t offset = m_head_offset;
+        for(std::deque< websocket_frame* >::iterator it = m_queue.begin(); it != m_queue.end() && count < IOV_COUNT; ++ it){
+            iv[count].iov_base = (char*)(*it)->data() + offset;
+            iv[count].iov_len = (*it)->size() - offset;
+            count ++;
+            offset = 0;
+        }
+        ssize_t temp = m_conn->send_data(iv, count);
+        if(temp <= -1){
+            if(errno == EAGAIN){
+                m_hub->want_write(m_sockfd);
+                return false;
+            }
+            /*连接已经断开，等待epoll报告挂断*/
+            m_evicted = true;
+            drop_queue();
+            return true;
+        }
+        m_queued -= temp;
+        while(temp > 0){
+            websocket_frame* front = m_queue.front();
+            size_t left = front->size() - m_head_offset;
+            if((size_t)temp < left){
+                m_head_offset += temp;
+                break;
+            }
+            temp -= left;
+            m_head_offset = 0;
+            m_queue.pop_front();
+            front->release();
+        }
+    }
+    return true;
+}
+
+void websocket_session::drop_queue(){
+    for(std::deque< websocket_frame* >::iterator it = m_queue.begin(); it != m_queue.end(); ++ it){
+        (*it)->release();
+    }
+    m_queue.clear();
+    m_head_offset = 0;
+    m_queued = 0;
+}
+
+/*在m_lock下登记等待，detach要么先发生(不再发送关闭帧)，要么在登记之后把它移除*/
+void websocket_session::close(uint16_t code){
+    m_lock.lock();
+    if(!m_close_sent && !m_detached && !m_evicted){
+        char payload[2];
+        payload[0] = code >> 8;
+        payload[1] = code;
+        m_queue.push_back(websocket_frame::create(OP_CLOSE, payload, sizeof(payload)));
+        m_queued += m_queue.back()->size();
+        m_close_sent = true;
+        if(m_queue.size() == 1){
+            flush_locked();
+        }
+        m_hub->await_close(this);
+    }
+    m_lock.unlock();
+}
+
+bool websocket_session::finished(){
+    m_lock.lock();
+    bool ret = m_evicted || (m_close_sent && m_close_received);
+    m_lock.unlock();
+    return ret;
+}
+
+/*与发送队列超限时一样关闭socket，由epoll报告的挂断事件走正常的关闭流程*/
+void websocket_session::close_timeout(){
+    m_lock.lock();
+    if(!m_detached && !m_evicted){
+        m_evicted = true;
+        drop_queue();
+        shutdown(m_sockfd, SHUT_RDWR);
+    }
+    m_lock.unlock();
+}
+
+void websocket_session::detach(){
+    m_lock.lock();
+    m_detached = true;
+    drop_queue();
+    m_lock.unlock();
+    m_hub->unsubscribe(this);
+}
+
+websocket_hub::websocket_hub(): m_epollfd(-1), m_stop_fd(-1), m_running(false),
+m_queue_limit(DEFAULT_QUEUE_LIMIT), m_handler(NULL){
+}
+
+websocket_hub::~websocket_hub(){
+    stop();
+}
+
+bool websocket_hub::start(size_t queue_limit, message_handler handler){
+    m_queue_limit = queue_limit;
+    m_handler = handler;
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_epollfd < 0 || m_stop_fd < 0){
+        stop();
+        return false;
+    }
+    epoll_event event;
+    event.data.fd = m_stop_fd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_stop_fd, &event);
+    if(pthread_create(&m_thread, NULL, worker, this) != 0){
+        stop();
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void websocket_hub::stop(){
+    if(m_running){
+        uint64_t one = 1;
+        ::write(m_stop_fd, &one, sizeof(one));
+        pthread_join(m_thread, NULL);
+        m_running = false;
+    }
+    for(size_t i = 0; i < m_close_waits.size(); i ++){
+        m_close_waits[i].second->release();
+    }
+    m_close_waits.clear();
+    if(m_epollfd >= 0){
+        ::close(m_epollfd);
+        m_epollfd = -1;
+    }
+    if(m_stop_fd >= 0){
+        ::close(m_stop_fd);
+        m_stop_fd = -1;
+    }
+}
+
+/*帧只编码一次。在hub的锁下复制订阅者列表并增加引用，发送时不持有hub的锁，
+  慢速连接的发送不会阻塞订阅、退订以及其他频道的publish*/
+int websocket_hub::publish(const char* channel, const char* data, size_t len, bool binary){
+    std::vector< websocket_session* > subscribers;
+    m_lock.lock();
+    std::map< std::string, std::vector< websocket_session* > >::iterator it = m_channels.find(channel);
+    if(it != m_channels.end()){
+        subscribers = it->second;
+        for(size_t i = 0; i < subscribers.size(); i ++){
+            subscribers[i]->acquire();
+        }
+    }
+    m_lock.unlock();
+    if(subscribers.empty()){
+        return 0;
+    }
+    websocket_frame* frame = websocket_frame::create(binary ? websocket_session::OP_BINARY : websocket_session::OP_TEXT,
+                                                     data, len);
+    int delivered = 0;
+    for(size_t i = 0; i < subscribers.size(); i ++){
+        if(subscribers[i]->send(frame)){
+            delivered ++;
+        }
+        subscribers[i]->release();
+    }
+    frame->release();
+    return delivered;
+}
+
+void websocket_hub::close_all(uint16_t code){
+    std::vector< websocket_session* > sessions;
+    m_lock.lock();
+    for(std::map< int, websocket_session* >::iterator it = m_sessions.begin(); it != m_sessions.end(); ++ it){
+        it->second->acquire();
+        sessions.push_back(it->second);
+    }
+    m_lock.unlock();
+    for(size_t i = 0; i < sessions.size(); i ++){
+        sessions[i]->close(code);
+        sessions[i]->release();
+    }
+}
+
+/*发送线程的epoll中只注册，等到发送队列写不完时再关注EPOLLOUT*/
+void websocket_hub::subscribe(websocket_session* session){
+    m_lock.lock();
+    std::vector< websocket_session* >& subscribers = m_channels[session->channel()];
+    session->m_index = subscribers.size();
+    subscribers.push_back(session);
+    m_sessions[session->m_sockfd] = session;
+    epoll_event event;
+    event.data.fd = session->m_sockfd;
+    event.events = EPOLLET | EPOLLONESHOT;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, session->m_sockfd, &event);
+    m_lock.unlock();
+}
+
+void websocket_hub::unsubscribe(websocket_session* session){
+    m_lock.lock();
+    std::map< std::string, std::vector< websocket_session* > >::iterator it = m_channels.find(session->channel());
+    if(it != m_channels.end()){
+        std::vector< websocket_session* >& subscribers = it->second;
+        if(session->m_index < subscribers.size() && subscribers[session->m_index] == session){
+            subscribers[session->m_index] = subscribers.back();
+            subscribers[session->m_index]->m_index = session->m_index;
+            subscribers.pop_back();
+        }
+        if(subscribers.empty()){
+            m_channels.erase(it);
+        }
+    }
+    std::map< int, websocket_session* >::iterator found = m_sessions.find(session->m_sockfd);
+    if(found != m_sessions.end() && found->second == session){
+        m_sessions.erase(found);
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, session->m_sockfd, NULL);
+    }
+    /*连接已经关闭，不再等待对方的关闭帧*/
+    bool waiting = false;
+    for(size_t i = 0; i < m_close_waits.size(); i ++){
+        if(m_close_waits[i].second == session){
+            m_close_waits.erase(m_close_waits.begin() + i);
+            waiting = true;
+            break;
+        }
+    }
+    m_lock.unlock();
+    if(waiting){
+        session->release();
+    }
+}
+
+void websocket_hub::want_write(int sockfd){
+    epoll_event event;
+    event.data.fd = sockfd;
+    event.events = EPOLLOUT | EPOLLET | EPOLLONESHOT;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, sockfd, &event);
+}
+
+static uint64_t now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void websocket_hub::await_close(websocket_session* session){
+    session->acquire();
+    m_lock.lock();
+    m_close_waits.push_back(std::make_pair(now_ms() + CLOSE_TIMEOUT, session));
+    m_lock.unlock();
+}
+
+void websocket_hub::expire_closes(){
+    std::vector< websocket_session* > expired;
+    uint64_t now = now_ms();
+    m_lock.lock();
+    while(!m_close_waits.empty() && m_close_waits.front().first <= now){
+        expired.push_back(m_close_waits.front().second);
+        m_close_waits.pop_front();
+    }
+    m_lock.unlock();
+    for(size_t i = 0; i < expired.size(); i ++){
+        expired[i]->close_timeout();
+        expired[i]->release();
+    }
+}
+
+void* websocket_hub::worker(void* arg){
+    websocket_hub* hub = (websocket_hub*)arg;
+    hub->run();
+    return hub;
+}
+
+/*socket可写时继续发送。先在hub的锁下找到连接并增加引用，发送时不持有hub的锁*/
+void websocket_hub::run(){
+    epoll_event events[64];
+    while(true){
+        int n = epoll_wait(m_epollfd, events, 64, 1000);
+        if(n < 0 && errno != EINTR){
+            return;
+        }
+        expire_closes();
+        for(int i = 0; i < n; i ++){
+            int fd = events[i].data.fd;
+            if(fd == m_stop_fd){
+                return;
+            }
+            m_lock.lock();
+            std::map< int, websocket_session* >::iterator it = m_sessions.find(fd);
+            websocket_session* session = it == m_sessions.end() ? NULL : it->second;
+            if(session){
+                session->acquire();
+            }
+            m_lock.unlock();
+            if(session){
+                session->flush();
+                session->release();
+            }
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "locker.h"
+
+class http_conn;
+class websocket_hub;
+
+/*一个编码好的帧(或者101响应)，publish只编码一次，所有订阅者的发送队列共享它，引用计数为0时释放*/
+class websocket_frame{
+public:
+    /*服务器发出的帧不加掩码*/
+    static websocket_frame* create(uint8_t opcode, const char* payload, size_t len);
+    /*原样发送的数据*/
+    static websocket_frame* create_raw(const char* data, size_t len);
+    void acquire(){ m_refs.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    websocket_frame(){}
+    static websocket_frame* allocate(size_t size);
+
+private:
+    std::atomic< int > m_refs;
+    size_t m_size;
+    char* m_data;
+};
+
+/*一个WebSocket连接(RFC 6455)，由http_conn在握手成功后创建，订阅以请求路径为名的频道。
+  读和解析与HTTP请求一样走epoll/oneshot：主线程read，工作线程process；
+  发送可能来自任意线程(publish、工作线程的pong以及websocket_hub的发送线程)，所有对socket的写以及读都在m_lock下进行，
+  TLS连接的SSL对象因此不会被并发使用*/
+class websocket_session{
+public:
+    /*帧的操作码*/
+    enum OPCODE{OP_CONTINUATION = 0, OP_TEXT = 1, OP_BINARY = 2,
+                OP_CLOSE = 8, OP_PING = 9, OP_PONG = 10};
+    /*关闭帧的状态码*/
+    enum CLOSE_CODE{CLOSE_NORMAL = 1000, CLOSE_GOING_AWAY = 1001,
+                    CLOSE_PROTOCOL_ERROR = 1002, CLOSE_INVALID_DATA = 1007, CLOSE_TOO_BIG = 1009};
+    /*接收的消息(所有分片合计)的最大长度*/
+    static const size_t MAX_MESSAGE = 64 * 1024;
+    /*一次writev最多使用的iovec数量*/
+    static const int IOV_COUNT = 64;
+
+public:
+    /*由Sec-WebSocket-Key计算Sec-WebSocket-Accept*/
+    static std::string accept_key(const char* key);
+    /*Sec-WebSocket-Key必须是16字节数据的base64编码*/
+    static bool valid_key(const char* key);
+    /*用4字节的掩码key对data做异或，data从载荷的开头开始*/
+    static void unmask(char* data, size_t len, const uint8_t* key);
+    /*增量校验UTF-8(RFC 3629)，state在分片之间保留，初始为0，消息结束时必须为0*/
+    static bool utf8_check(const uint8_t* p, size_t len, uint32_t* state);
+    /*对方可以在关闭帧中发送的状态码(RFC 6455 7.4)*/
+    static bool valid_close_code(uint16_t code);
+
+    /*response是握手的101响应，它作为第一块数据排队，保证在任何推送的帧之前发出。引用计数从1开始，属于conn*/
+    websocket_session(http_conn* conn, int sockfd, websocket_hub* hub, const char* url,
+                      const char* response, size_t len);
+    void acquire(){ m_refs.fetch_add(1, std::memory_order_relaxed); }
+    void release();
+    const std::string& channel() const { return m_channel; }
+
+    /*主线程：读取socket上的数据，对方关闭或者出错时返回false*/
+    bool read();
+    /*保存握手请求之后已经读到的数据*/
+    void buffer_input(const char* data, size_t len);
+    /*工作线程：处理所有完整的帧，回应ping和关闭帧，完整的消息交给websocket_hub的处理函数*/
+    void process();
+    /*把帧加入发送队列并尝试立即发送，返回帧是否被接收。已经发送了关闭帧、被淘汰或者已经退订的连接返回false；
+      队列超出websocket_hub的限制时淘汰该连接(关闭socket，之后由epoll报告的挂断事件走正常的关闭流程)并返回false*/
+    bool send(websocket_frame* frame);
+    /*尽量写出发送队列，返回队列是否已经清空；socket暂时不可写时由websocket_hub的发送线程在可写时继续*/
+    bool flush();
+    /*发送关闭帧，之后不再发送其他帧。可以重复调用。
+      本端先发送关闭帧时连接继续读取，等待对方的关闭帧，超过websocket_hub::CLOSE_TIMEOUT后淘汰该连接*/
+    void close(uint16_t code);
+    /*关闭握手已经完成(双方都发送了关闭帧)或者连接已经被淘汰，发送队列清空后应该关闭TCP连接。
+      只由主线程的write和工作线程的process调用*/
+    bool finished();
+    /*关闭握手超时，由websocket_hub的发送线程调用*/
+    void close_timeout();
+    /*连接关闭时调用：退订频道，之后的发送都被忽略*/
+    void detach();
+
+private:
+    ~websocket_session();
+    /*调用时必须持有m_lock*/
+    bool flush_locked();
+    void drop_queue();
+    void fail(uint16_t code);
+    bool handle_frame(uint8_t opcode, bool fin, const char* payload, size_t len);
+
+private:
+    friend class websocket_hub;
+
+    std::atomic< int > m_refs;
+    http_conn* m_conn;
+    int m_sockfd;
+    websocket_hub* m_hub;
+    std::string m_channel;
+    /*在频道订阅者列表中的位置，由websocket_hub在持有其锁时维护*/
+    size_t m_index;
+
+    /*保护发送队列以及socket读写*/
+    locker m_lock;
+    std::deque< websocket_frame* > m_queue;
+    /*队首的帧已经发出的字节数*/
+    size_t m_head_offset;
+    /*队列中还未发出的字节数*/
+    size_t m_queued;
+    bool m_detached;
+    bool m_evicted;
+    bool m_close_sent;
+
+    /*以下只由主线程的read和工作线程的process按顺序访问(oneshot保证)，不需要加锁*/
+    std::string m_in;
+    /*正在接收的分片消息，m_message_opcode为0表示没有*/
+    std::string m_message;
+    uint8_t m_message_opcode;
+    /*文本消息的UTF-8校验状态，跨分片保留*/
+    uint32_t m_utf8_state;
+    bool m_close_received;
+};
+
+/*WebSocket的发布中心：按频道(握手请求的路径)管理订阅者，publish把消息编码成一个帧后writev给每个订阅者。
+  每个连接有自己的发送队列，写不完的部分由发送线程在socket可写时继续发送；
+  队列超过queue_limit字节的慢速连接被淘汰，不会拖慢其他订阅者，也不会无限占用内存*/
+class websocket_hub{
+public:
+    /*每个连接发送队列的默认上限*/
+    static const size_t DEFAULT_QUEUE_LIMIT = 1024 * 1024;
+    /*发送关闭帧之后等待对方关闭帧的时间(毫秒)，发送线程每秒检查一次*/
+    static const int CLOSE_TIMEOUT = 5000;
+    /*客户端发来的消息的处理函数，在工作线程中调用*/
+    typedef void (*message_handler)(const std::string& channel, const char* data, size_t len, bool binary);
+
+public:
+    websocket_hub();
+    ~websocket_hub();
+    /*启动发送线程，必须在把hub交给http_conn::m_websocket之前调用。handler可以为NULL，此时忽略客户端的消息*/
+    bool start(size_t queue_limit = DEFAULT_QUEUE_LIMIT, message_handler handler = NULL);
+    void stop();
+    /*向频道channel的所有订阅者发送一条消息，可以在任意线程调用，返回接收该消息的订阅者数量*/
+    int publish(const char* channel, const char* data, size_t len, bool binary = false);
+    /*向所有连接发送关闭帧，平滑重启时与http_conn::m_draining一起使用*/
+    void close_all(uint16_t code = websocket_session::CLOSE_GOING_AWAY);
+
+    /*以下供websocket_session和http_conn使用*/
+    void subscribe(websocket_session* session);
+    void unsubscribe(websocket_session* session);
+    /*socket可写时由发送线程继续发送*/
+    void want_write(int sockfd);
+    /*会话发送了关闭帧，超时之后由发送线程淘汰它；调用者持有会话的m_lock，unsubscribe时取消等待*/
+    void await_close(websocket_session* session);
+    size_t queue_limit() const { return m_queue_limit; }
+    message_handler handler() const { return m_handler; }
+
+private:
+    static void* worker(void* arg);
+    void run();
+    /*淘汰关闭握手已经超时的会话*/
+    void expire_closes();
+
+private:
+    /*保护m_channels、m_sessions和m_close_waits；持有它时不获取任何session的锁，发送前先复制列表并增加引用。
+      加锁顺序为先session后hub*/
+    locker m_lock;
+    std::map< std::string, std::vector< websocket_session* > > m_channels;
+    std::map< int, websocket_session* > m_sessions;
+    /*等待对方关闭帧的会话及其期限，超时时间相同，按期限排序；每个会话持有一个引用*/
+    std::deque< std::pair< uint64_t, websocket_session* > > m_close_waits;
+    /*发送线程等待socket可写的epoll，与主线程的epoll相互独立*/
+    int m_epollfd;
+    int m_stop_fd;
+    pthread_t m_thread;
+    bool m_running;
+    size_t m_queue_limit;
+    message_handler m_handler;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 //封装信号量
 class sem{
@@ -42,6 +43,10 @@ public:
     bool unlock(){
         return pthread_mutex_unlock(&m_mutex) == 0;
     }
+    /*获得底层的互斥锁，供条件变量配合使用*/
+    pthread_mutex_t* get(){
+        return &m_mutex;
+    }
 private:
     pthread_mutex_t m_mutex;
 };
@@ -69,9 +74,20 @@ public:
         pthread_mutex_unlock(&m_mutex);
         return ret == 0;
     }
+    /*配合外部互斥锁使用，调用前mutex必须已加锁*/
+    bool wait(pthread_mutex_t* mutex){
+        return pthread_cond_wait(&m_cond, mutex) == 0;
+    }
+    /*等待到绝对时间abstime(CLOCK_REALTIME)为止，超时返回false*/
+    bool timewait(pthread_mutex_t* mutex, struct timespec abstime){
+        return pthread_cond_timedwait(&m_cond, mutex, &abstime) == 0;
+    }
     bool signal(){
         return pthread_cond_signal(&m_cond) == 0;
     }
+    bool broadcast(){
+        return pthread_cond_broadcast(&m_cond) == 0;
+    }
 private:
     pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
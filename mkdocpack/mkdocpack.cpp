@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+#include "docpack.h"
+
+/*将doc_root打包成docpack归档：mkdocpack <doc_root> <archive>*/
+int main(int argc, char* argv[]){
+    if(argc != 3){
+        fprintf(stderr, "usage: %s <doc_root> <archive>\n", argv[0]);
+        return 1;
+    }
+    if(!docpack_build(argv[1], argv[2])){
+        return 1;
+    }
+    return 0;
+}
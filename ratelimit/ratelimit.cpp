@@ -0,0 +1,168 @@
+#include "ratelimit.h"
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/*状态的低24位是剩余令牌数(千分之一个令牌)，高40位是上次补充令牌的时间(毫秒)*/
+static const int TOKEN_BITS = 24;
+static const uint64_t TOKEN_MASK = (1ull << TOKEN_BITS) - 1;
+/*一个请求消耗的令牌(千分之一个令牌)*/
+static const uint64_t TOKEN_COST = 1000;
+/*每秒补充令牌数的上限，保证补充的计算不会溢出*/
+static const int MAX_RATE = 1000000;
+/*键的高32位区分地址和子网，低32位是地址或者子网号(主机字节序)，因此键不会为0*/
+static const uint64_t HOST_KEY = 1ull << 32;
+static const uint64_t SUBNET_KEY = 2ull << 32;
+/*时钟从这个值开始计数，比任何桶补满所需的时间都长，因此状态为0(包括新占用的槽)总是表示满的桶*/
+static const int64_t CLOCK_START_MS = 1ll << 31;
+
+ratelimit::ratelimit(): m_slots(NULL), m_group_mask(0), m_subnet_mask(0), m_epoch_ms(0){
+    m_host.rate = m_host.burst = m_host.full_ms = 0;
+    m_subnet = m_host;
+}
+
+ratelimit::~ratelimit(){
+    free(m_slots);
+}
+
+static bool make_config(int rate, int burst, uint64_t* config_rate, uint64_t* config_burst, uint64_t* full_ms){
+    if(rate <= 0 || rate > MAX_RATE || burst <= 0 || burst > ratelimit::MAX_BURST){
+        return false;
+    }
+    *config_rate = rate;
+    *config_burst = (uint64_t)burst * TOKEN_COST;
+    *full_ms = (*config_burst + rate - 1) / rate;
+    return true;
+}
+
+bool ratelimit::init(int capacity, int rate, int burst, int subnet_prefix, int subnet_rate, int subnet_burst){
+    if(capacity <= 0 || subnet_prefix < 0 || subnet_prefix > 32 ||
+       !make_config(rate, burst, &m_host.rate, &m_host.burst, &m_host.full_ms) ||
+       (subnet_rate != 0 && !make_config(subnet_rate, subnet_burst, &m_subnet.rate, &m_subnet.burst, &m_subnet.full_ms))){
+        fprintf(stderr, "ratelimit: invalid configuration\n");
+        return false;
+    }
+    m_subnet_mask = subnet_prefix == 0 ? 0 : ~0u << (32 - subnet_prefix);
+
+    uint64_t groups = 1;
+    while(groups * GROUP_SLOTS < (uint64_t)capacity){
+        groups <<= 1;
+    }
+    void* memory = NULL;
+    if(posix_memalign(&memory, GROUP_SLOTS * sizeof(slot), groups * GROUP_SLOTS * sizeof(slot)) != 0){
+        fprintf(stderr, "ratelimit: cannot allocate %d buckets\n", capacity);
+        return false;
+    }
+    free(m_slots);
+    m_slots = (slot*)memory;
+    for(uint64_t i = 0; i < groups * GROUP_SLOTS; i ++){
+        new (&m_slots[i]) slot();
+        m_slots[i].key.store(0, std::memory_order_relaxed);
+        m_slots[i].state.store(0, std::memory_order_relaxed);
+    }
+    m_group_mask = groups - 1;
+    m_epoch_ms = 0;
+    m_epoch_ms = (int64_t)now_ms() - CLOCK_START_MS;
+    return true;
+}
+
+/*先检查地址自己的桶，被拒绝的请求不再消耗子网的令牌。
+  表通常比缓存大，两个桶所在的缓存行先一起预取，使两次内存访问重叠*/
+bool ratelimit::allow(in_addr_t addr, int requests){
+    uint32_t ip = ntohl(addr);
+    uint64_t host_key = HOST_KEY | ip;
+    uint64_t subnet_key = SUBNET_KEY | (ip & m_subnet_mask);
+    slot* host = group(host_key);
+    slot* subnet = group(subnet_key);
+    __builtin_prefetch(host, 1);
+    if(m_subnet.rate != 0){
+        __builtin_prefetch(subnet, 1);
+    }
+    uint64_t cost = (uint64_t)requests * TOKEN_COST;
+    uint64_t now = now_ms();
+    if(!take(host, host_key, m_host, cost, now)){
+        return false;
+    }
+    return m_subnet.rate == 0 || take(subnet, subnet_key, m_subnet, cost, now);
+}
+
+ratelimit::slot* ratelimit::group(uint64_t key) const{
+    return m_slots + (((key * 0x9E3779B97F4A7C15ull) >> 32) & m_group_mask) * GROUP_SLOTS;
+}
+
+/*按经过的时间补充令牌后消耗cost。即使拒绝也写回补充后的状态，不足一个令牌的部分不会丢失*/
+bool ratelimit::take(slot* slots, uint64_t key, const bucket_config& config, uint64_t cost, uint64_t now){
+    slot* s = find(slots, key, now);
+    uint64_t old = s->state.load(std::memory_order_relaxed);
+    while(true){
+        uint64_t last = old >> TOKEN_BITS;
+        uint64_t tokens = old & TOKEN_MASK;
+        if(now > last){
+            tokens = now - last >= config.full_ms ? config.burst : tokens + (now - last) * config.rate;
+            if(tokens > config.burst){
+                tokens = config.burst;
+            }
+            last = now;
+        }
+        bool allowed = tokens >= cost;
+        if(allowed){
+            tokens -= cost;
+        }
+        uint64_t next = (last << TOKEN_BITS) | tokens;
+        if(next == old || s->state.compare_exchange_weak(old, next, std::memory_order_relaxed)){
+            return allowed;
+        }
+    }
+}
+
+/*同一个键的槽总是在第一个空槽之前(槽被占用后不会再变空)，所以遇到空槽就可以占用它。
+  复用或者淘汰一个槽时，赢得键的CAS之后无条件把状态清零(满的桶)，新键不会继承旧键的令牌；
+  清零之前已经通过find拿到这个槽、正在为旧键take的线程会因状态改变而重试，
+  把它这一次的消耗记到新键上，所以误差只是这些并发请求各自的一次消耗*/
+ratelimit::slot* ratelimit::find(slot* slots, uint64_t key, uint64_t now){
+    while(true){
+        slot* victim = NULL;
+        uint64_t victim_key = 0;
+        uint64_t victim_state = 0;
+        bool victim_idle = false;
+        for(int i = 0; i < GROUP_SLOTS; i ++){
+            slot* s = &slots[i];
+            uint64_t k = s->key.load(std::memory_order_acquire);
+            if(k == 0 && s->key.compare_exchange_strong(k, key, std::memory_order_acq_rel)){
+                return s;
+            }
+            if(k == key){
+                return s;
+            }
+            if(victim_idle){
+                continue;
+            }
+            /*已经补满的桶可以直接复用，否则记下最久未使用的桶*/
+            uint64_t state = s->state.load(std::memory_order_relaxed);
+            uint64_t last = state >> TOKEN_BITS;
+            const bucket_config& owner = (k & SUBNET_KEY) ? m_subnet : m_host;
+            bool idle = now >= last && now - last >= owner.full_ms;
+            if(idle || !victim || last < (victim_state >> TOKEN_BITS)){
+                victim = s;
+                victim_key = k;
+                victim_state = state;
+                victim_idle = idle;
+            }
+        }
+        /*状态为0表示满的桶*/
+        if(victim->key.compare_exchange_strong(victim_key, key, std::memory_order_acq_rel)){
+            victim->state.store(0, std::memory_order_relaxed);
+            return victim;
+        }
+    }
+}
+
+/*使用粗粒度时钟：读取只需要几纳秒，几毫秒的精度对限速足够*/
+uint64_t ratelimit::now_ms() const{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - m_epoch_ms;
+}
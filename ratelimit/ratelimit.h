@@ -0,0 +1,62 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <netinet/in.h>
+
+/*按客户端IPv4地址及其所在子网限速的令牌桶，主线程在把请求交给线程池之前调用allow。
+  桶保存在固定大小的开放寻址哈希表中，没有锁：每个槽的键和状态各是一个64位原子变量，
+  状态把上次补充令牌的时间(毫秒)和剩余令牌数(千分之一个令牌)打包在一起，用CAS更新。
+  空闲到令牌已经补满的桶与不存在的桶等价，可以直接被其他地址复用；没有这样的槽时淘汰最久未使用的桶，
+  所以无论有多少个不同的源地址，内存都不超过init时指定的容量*/
+class ratelimit{
+public:
+    /*一个键映射到一组槽，每组正好占一个缓存行，查找只访问这一个缓存行*/
+    static const int GROUP_SLOTS = 4;
+    /*桶容量的上限(令牌数)，受打包状态中令牌字段宽度的限制*/
+    static const int MAX_BURST = 16000;
+
+public:
+    ratelimit();
+    ~ratelimit();
+    /*capacity是表中最多保存的桶数量(地址和子网合计)；每个地址每秒补充rate个令牌，最多积累burst个；
+      subnet_rate不为0时，同一个/subnet_prefix子网中的所有地址还共享一个每秒subnet_rate、容量subnet_burst的桶*/
+    bool init(int capacity, int rate, int burst, int subnet_prefix = 24, int subnet_rate = 0, int subnet_burst = 0);
+    /*为地址addr(网络字节序)的requests个请求消耗令牌，返回false表示超出限速*/
+    bool allow(in_addr_t addr, int requests = 1);
+
+private:
+    /*一个槽，键为0表示空槽*/
+    struct slot{
+        std::atomic< uint64_t > key;
+        std::atomic< uint64_t > state;
+    };
+    /*一种桶的参数：每毫秒补充的千分之一令牌数恰好等于每秒的令牌数*/
+    struct bucket_config{
+        uint64_t rate;
+        uint64_t burst;
+        /*空闲这么久之后桶一定已经补满*/
+        uint64_t full_ms;
+    };
+    /*在组slots中键key的桶里消耗cost(千分之一个令牌)*/
+    bool take(slot* slots, uint64_t key, const bucket_config& config, uint64_t cost, uint64_t now);
+    /*key所在的组*/
+    slot* group(uint64_t key) const;
+    /*在组slots中找到key的槽，不存在时占用一个空闲或者最久未使用的槽*/
+    slot* find(slot* slots, uint64_t key, uint64_t now);
+    /*距init的毫秒数*/
+    uint64_t now_ms() const;
+
+private:
+    slot* m_slots;
+    /*组数减一，组数是2的幂*/
+    uint64_t m_group_mask;
+    bucket_config m_host;
+    bucket_config m_subnet;
+    /*子网掩码(主机字节序)，m_subnet.rate为0时不按子网限速*/
+    uint32_t m_subnet_mask;
+    int64_t m_epoch_ms;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/*测试用的断言：失败时打印位置并继续，main最后返回check_result()*/
+static int check_failures = 0;
+
+#define CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            check_failures ++; \
+        } \
+    }while(0)
+
+static inline int check_result(){
+    if(check_failures){
+        fprintf(stderr, "%d check(s) failed\n", check_failures);
+    }
+    return check_failures ? 1 : 0;
+}
+
+#endif
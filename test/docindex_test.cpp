@@ -0,0 +1,76 @@
+#include "docindex.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <sys/stat.h>
+
+static void write_file(const std::string& path, const char* data){
+    FILE* fp = fopen(path.c_str(), "wb");
+    fwrite(data, 1, strlen(data), fp);
+    fclose(fp);
+}
+
+static docindex::LOOKUP_RESULT lookup(docindex& index, const char* path, docindex_entry* entry = NULL){
+    docindex_entry tmp;
+    return index.lookup(path, strlen(path), entry ? entry : &tmp);
+}
+
+/*inotify线程异步发布更新，最多等待2秒*/
+static bool wait_for(docindex& index, const char* path, docindex::LOOKUP_RESULT expected){
+    for(int i = 0; i < 200; i ++){
+        if(lookup(index, path) == expected){
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+int main(){
+    char root[] = "/tmp/docindex_test.XXXXXX";
+    CHECK(mkdtemp(root) != NULL);
+    std::string dir = root;
+    mkdir((dir + "/sub").c_str(), 0755);
+    write_file(dir + "/a.txt", "hello");
+
+    docindex index;
+    CHECK(!docindex().open((dir + "/missing").c_str()));
+    CHECK(index.open(root));
+
+    docindex_entry entry;
+    struct stat st;
+    stat((dir + "/a.txt").c_str(), &st);
+    CHECK(lookup(index, "/a.txt", &entry) == docindex::FOUND);
+    CHECK(entry.ino == st.st_ino && entry.size == 5 && S_ISREG(entry.mode));
+    CHECK(lookup(index, "/sub", &entry) == docindex::FOUND && S_ISDIR(entry.mode));
+    CHECK(lookup(index, "/sub/", &entry) == docindex::FOUND);
+    /*完整的索引中找不到即为不存在*/
+    CHECK(lookup(index, "/b.txt") == docindex::NOT_FOUND);
+    /*"."、".."和"//"交给文件系统处理*/
+    CHECK(lookup(index, "/sub/../a.txt") == docindex::UNKNOWN);
+    CHECK(lookup(index, "/./a.txt") == docindex::UNKNOWN);
+    CHECK(lookup(index, "//a.txt") == docindex::UNKNOWN);
+    CHECK(lookup(index, "a.txt") == docindex::UNKNOWN);
+
+    /*之后的修改由inotify线程更新*/
+    write_file(dir + "/sub/b.txt", "b");
+    CHECK(wait_for(index, "/sub/b.txt", docindex::FOUND));
+    mkdir((dir + "/new").c_str(), 0755);
+    write_file(dir + "/new/c.txt", "c");
+    CHECK(wait_for(index, "/new/c.txt", docindex::FOUND));
+    unlink((dir + "/a.txt").c_str());
+    CHECK(wait_for(index, "/a.txt", docindex::NOT_FOUND));
+    rename((dir + "/new").c_str(), (dir + "/moved").c_str());
+    CHECK(wait_for(index, "/new/c.txt", docindex::NOT_FOUND));
+    CHECK(wait_for(index, "/moved/c.txt", docindex::FOUND));
+    index.close();
+
+    unlink((dir + "/moved/c.txt").c_str());
+    rmdir((dir + "/moved").c_str());
+    unlink((dir + "/sub/b.txt").c_str());
+    rmdir((dir + "/sub").c_str());
+    rmdir(root);
+    return check_result();
+}
@@ -0,0 +1,77 @@
+#include "docpack.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <sys/stat.h>
+
+static void write_file(const std::string& path, const char* data){
+    FILE* fp = fopen(path.c_str(), "wb");
+    fwrite(data, 1, strlen(data), fp);
+    fclose(fp);
+}
+
+static const docpack_entry* lookup(docpack_archive* archive, const char* path){
+    return archive->lookup(path, strlen(path));
+}
+
+int main(){
+    /*FNV-1a 64位的标准测试向量*/
+    CHECK(docpack_hash("", 0) == 0xcbf29ce484222325ULL);
+    CHECK(docpack_hash("a", 1) == 0xaf63dc4c8601ec8cULL);
+    CHECK(docpack_hash("foobar", 6) == 0x85944171f73967e8ULL);
+
+    char root[] = "/tmp/docpack_test.XXXXXX";
+    CHECK(mkdtemp(root) != NULL);
+    std::string dir = root;
+    mkdir((dir + "/sub").c_str(), 0755);
+    write_file(dir + "/a.txt", "a");
+    write_file(dir + "/a.txt.gz", "foobar");
+    write_file(dir + "/sub/index.html", "<html></html>");
+    std::string pack = dir + ".pack";
+    CHECK(docpack_build(root, pack.c_str()));
+
+    docpack_archive* archive = docpack_archive::load(pack.c_str());
+    CHECK(archive != NULL);
+    if(archive){
+        const docpack_entry* a = lookup(archive, "/a.txt");
+        CHECK(a != NULL);
+        if(a){
+            CHECK(a->data_size == 1 && memcmp(archive->data(a), "a", 1) == 0);
+            CHECK(a->gzip_size == 6 && memcmp(archive->gzip_data(a), "foobar", 6) == 0);
+            CHECK(a->data_offset % DOCPACK_ALIGN == 0 && a->gzip_offset % DOCPACK_ALIGN == 0);
+            /*ETag为"大小-内容哈希"，预压缩版本有自己的ETag*/
+            CHECK(strcmp(a->etag, "\"1-af63dc4c8601ec8c\"") == 0);
+            CHECK(strcmp(a->gzip_etag, "\"6-85944171f73967e8-gz\"") == 0);
+            CHECK(std::string(archive->content_type(a), a->type_len) == "text/plain; charset=utf-8");
+        }
+        const docpack_entry* html = lookup(archive, "/sub/index.html");
+        CHECK(html != NULL);
+        if(html){
+            CHECK(html->gzip_size == 0 && html->gzip_etag[0] == '\0');
+            CHECK(std::string(archive->content_type(html), html->type_len) == "text/html; charset=utf-8");
+        }
+        /*预压缩文件本身不作为独立条目*/
+        CHECK(lookup(archive, "/a.txt.gz") == NULL);
+        CHECK(lookup(archive, "/missing") == NULL);
+        CHECK(lookup(archive, "/sub") == NULL);
+        archive->put();
+    }
+
+    /*版本不符的归档被拒绝*/
+    FILE* fp = fopen(pack.c_str(), "r+b");
+    uint32_t version = DOCPACK_VERSION - 1;
+    fseek(fp, offsetof(docpack_header, version), SEEK_SET);
+    fwrite(&version, sizeof(version), 1, fp);
+    fclose(fp);
+    CHECK(docpack_archive::load(pack.c_str()) == NULL);
+
+    unlink(pack.c_str());
+    unlink((dir + "/sub/index.html").c_str());
+    rmdir((dir + "/sub").c_str());
+    unlink((dir + "/a.txt").c_str());
+    unlink((dir + "/a.txt.gz").c_str());
+    rmdir(root);
+    return check_result();
+}
@@ -0,0 +1,164 @@
+#include "hpack.h"
+#include "check.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*十六进制字符串(可以含空格)转换为字节*/
+static std::string unhex(const char* hex){
+    std::string out;
+    int high = -1;
+    for(const char* p = hex; *p; p ++){
+        int v;
+        if(*p >= '0' && *p <= '9'){
+            v = *p - '0';
+        }
+        else if(*p >= 'a' && *p <= 'f'){
+            v = *p - 'a' + 10;
+        }
+        else{
+            continue;
+        }
+        if(high < 0){
+            high = v;
+        }
+        else{
+            out.push_back((char)(high << 4 | v));
+            high = -1;
+        }
+    }
+    return out;
+}
+
+/*解码一个头部块，并与以'\0'分隔的期望字段列表"name\0value\0..."比较*/
+static bool decode_equals(hpack_decoder& decoder, const char* hex, const char* const* expected, size_t count){
+    std::string block = unhex(hex);
+    std::vector< hpack_header > headers;
+    if(!decoder.decode((const uint8_t*)block.data(), block.size(), headers) || headers.size() != count){
+        return false;
+    }
+    for(size_t i = 0; i < count; i ++){
+        if(headers[i].name != expected[2 * i] || headers[i].value != expected[2 * i + 1]){
+            fprintf(stderr, "header %zu: %s: %s\n", i, headers[i].name.c_str(), headers[i].value.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+#define DECODE_EQUALS(decoder, hex, ...) \
+    do{ \
+        static const char* const expected[] = {__VA_ARGS__}; \
+        CHECK(decode_equals(decoder, hex, expected, sizeof(expected) / sizeof(expected[0]) / 2)); \
+    }while(0)
+
+int main(){
+    /*RFC 7541 C.2.1：加入动态表的字面字段*/
+    {
+        hpack_decoder decoder;
+        DECODE_EQUALS(decoder, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+                      "custom-key", "custom-header");
+    }
+
+    /*C.3：不使用Huffman编码的请求，三个头部块共用一个解码器*/
+    {
+        hpack_decoder decoder;
+        DECODE_EQUALS(decoder, "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                      ":method", "GET", ":scheme", "http", ":path", "/", ":authority", "www.example.com");
+        DECODE_EQUALS(decoder, "8286 84be 5808 6e6f 2d63 6163 6865",
+                      ":method", "GET", ":scheme", "http", ":path", "/", ":authority", "www.example.com",
+                      "cache-control", "no-cache");
+        DECODE_EQUALS(decoder, "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+                      ":method", "GET", ":scheme", "https", ":path", "/index.html", ":authority", "www.example.com",
+                      "custom-key", "custom-value");
+    }
+
+    /*C.4：使用Huffman编码的请求*/
+    {
+        hpack_decoder decoder;
+        DECODE_EQUALS(decoder, "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                      ":method", "GET", ":scheme", "http", ":path", "/", ":authority", "www.example.com");
+        DECODE_EQUALS(decoder, "8286 84be 5886 a8eb 1064 9cbf",
+                      ":method", "GET", ":scheme", "http", ":path", "/", ":authority", "www.example.com",
+                      "cache-control", "no-cache");
+        DECODE_EQUALS(decoder, "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+                      ":method", "GET", ":scheme", "https", ":path", "/index.html", ":authority", "www.example.com",
+                      "custom-key", "custom-value");
+    }
+
+    /*C.6：使用Huffman编码的响应，动态表上限为256字节，第三个块会逐出之前的字段*/
+    {
+        hpack_decoder decoder(256);
+        DECODE_EQUALS(decoder,
+                      "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+                      "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+                      ":status", "302", "cache-control", "private", "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+                      "location", "https://www.example.com");
+        DECODE_EQUALS(decoder, "4883 640e ffc1 c0bf",
+                      ":status", "307", "cache-control", "private", "date", "Mon, 21 Oct 2013 20:13:21 GMT",
+                      "location", "https://www.example.com");
+        DECODE_EQUALS(decoder,
+                      "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab"
+                      "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+                      "9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+                      ":status", "200", "cache-control", "private", "date", "Mon, 21 Oct 2013 20:13:22 GMT",
+                      "location", "https://www.example.com", "content-encoding", "gzip",
+                      "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1");
+    }
+
+    /*Huffman编码与C.4.1中的字符串一致*/
+    {
+        std::string out;
+        hpack_huffman_encode("www.example.com", 15, out);
+        CHECK(out == unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+        CHECK(hpack_huffman_length("www.example.com", 15) == 12);
+        std::string decoded;
+        CHECK(hpack_huffman_decode((const uint8_t*)out.data(), out.size(), decoded) && decoded == "www.example.com");
+        /*填充必须是EOS的前缀(全1)且不超过7位*/
+        CHECK(!hpack_huffman_decode((const uint8_t*)"\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xfe", 12, decoded));
+        CHECK(!hpack_huffman_decode((const uint8_t*)"\xff\xff\xff\xff", 4, decoded));
+    }
+
+    /*编码器输出的头部块可以被解码器还原，重复的字段引用动态表*/
+    {
+        hpack_encoder encoder;
+        hpack_decoder decoder;
+        for(int round = 0; round < 2; round ++){
+            std::string block;
+            encoder.begin(block);
+            encoder.encode(":status", "200", true, block);
+            encoder.encode("content-type", "text/html; charset=utf-8", true, block);
+            encoder.encode("etag", "\"1-af63dc4c8601ec8c\"", false, block);
+            std::vector< hpack_header > headers;
+            CHECK(decoder.decode((const uint8_t*)block.data(), block.size(), headers));
+            CHECK(headers.size() == 3 && headers[1].value == "text/html; charset=utf-8" &&
+                  headers[2].value == "\"1-af63dc4c8601ec8c\"");
+            if(round == 1){
+                CHECK(block.size() < 30);
+            }
+        }
+    }
+
+    /*find不修改动态表：C.3.3在C.3.1和C.3.2之后查找:path*/
+    {
+        hpack_decoder decoder;
+        std::vector< hpack_header > headers;
+        std::string first = unhex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+        std::string third = unhex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65");
+        std::string value;
+        CHECK(decoder.find((const uint8_t*)first.data(), first.size(), ":path", value) == 1 && value == "/");
+        CHECK(decoder.find((const uint8_t*)first.data(), first.size(), "cookie", value) == 0);
+        CHECK(decoder.decode((const uint8_t*)first.data(), first.size(), headers));
+        CHECK(decoder.find((const uint8_t*)third.data(), third.size(), ":path", value) == 1 && value == "/index.html");
+        /*引用本块中新加入的字段时无法确定*/
+        std::string self = unhex("4005 3a70 6174 6801 2fbe");
+        CHECK(decoder.find((const uint8_t*)self.data(), self.size(), ":path", value) == 1 && value == "/");
+        std::string later = unhex("4001 7801 79be 8286");
+        CHECK(decoder.find((const uint8_t*)later.data(), later.size(), ":authority", value) == -1);
+        /*非法的索引*/
+        std::string bad = unhex("ff7f");
+        CHECK(decoder.find((const uint8_t*)bad.data(), bad.size(), ":path", value) == -1);
+        CHECK(!decoder.decode((const uint8_t*)bad.data(), bad.size(), headers));
+    }
+    return check_result();
+}
@@ -0,0 +1,68 @@
+#include "ratelimit.h"
+#include "check.h"
+#include <unistd.h>
+#include <arpa/inet.h>
+
+static in_addr_t addr(uint32_t host){
+    return htonl(host);
+}
+
+/*连续请求直到被拒绝，返回被允许的次数*/
+static int drain(ratelimit& limit, in_addr_t a, int max = 100){
+    int allowed = 0;
+    while(allowed < max && limit.allow(a)){
+        allowed ++;
+    }
+    return allowed;
+}
+
+int main(){
+    /*非法配置*/
+    {
+        ratelimit limit;
+        CHECK(!limit.init(0, 10, 3));
+        CHECK(!limit.init(16, 10, ratelimit::MAX_BURST + 1));
+        CHECK(!limit.init(16, 10, 3, 33));
+    }
+
+    /*每个地址一个桶：burst个请求之后被拒绝，其他地址不受影响；一次消耗多个令牌*/
+    {
+        ratelimit limit;
+        CHECK(limit.init(1024, 10, 3));
+        CHECK(drain(limit, addr(0x0a000001)) == 3);
+        CHECK(drain(limit, addr(0x0a000002)) == 3);
+        CHECK(limit.allow(addr(0x0a000003), 2));
+        CHECK(!limit.allow(addr(0x0a000003), 2));
+        CHECK(limit.allow(addr(0x0a000003), 1));
+        /*每秒10个令牌，250毫秒后至少补充了2个，但不超过burst*/
+        usleep(250 * 1000);
+        int allowed = drain(limit, addr(0x0a000001));
+        CHECK(allowed >= 2 && allowed <= 3);
+    }
+
+    /*同一个/24子网中的地址共享子网的桶*/
+    {
+        ratelimit limit;
+        CHECK(limit.init(1024, 10, 3, 24, 10, 4));
+        CHECK(drain(limit, addr(0xc0a80101)) == 3);
+        CHECK(drain(limit, addr(0xc0a80102)) == 1);
+        CHECK(drain(limit, addr(0xc0a80201)) == 3);
+    }
+
+    /*一组4个槽都被占用且都未补满时淘汰最久未使用的桶，复用的桶从满的令牌开始*/
+    {
+        ratelimit limit;
+        CHECK(limit.init(ratelimit::GROUP_SLOTS, 10, 3));
+        for(uint32_t i = 1; i <= (uint32_t)ratelimit::GROUP_SLOTS; i ++){
+            CHECK(drain(limit, addr(0x0a000000 + i)) == 3);
+        }
+        CHECK(drain(limit, addr(0x0b000001)) == 3);
+        /*容量固定：大量不同的地址不会使内存增长，新地址总能拿到一个桶*/
+        int fresh = 0;
+        for(uint32_t i = 0; i < 10000; i ++){
+            fresh += limit.allow(addr(0x0c000000 + i));
+        }
+        CHECK(fresh == 10000);
+    }
+    return check_result();
+}
@@ -0,0 +1,100 @@
+#include "websocket.h"
+#include "check.h"
+#include <string.h>
+#include <string>
+
+static bool utf8(const char* data, size_t len){
+    uint32_t state = 0;
+    return websocket_session::utf8_check((const uint8_t*)data, len, &state) && state == 0;
+}
+
+#define UTF8(literal) utf8(literal, sizeof(literal) - 1)
+
+int main(){
+    /*RFC 6455 1.3中的例子*/
+    CHECK(websocket_session::accept_key("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    CHECK(websocket_session::valid_key("dGhlIHNhbXBsZSBub25jZQ=="));
+    CHECK(!websocket_session::valid_key("dGhlIHNhbXBsZSBub25jZQ="));
+    CHECK(!websocket_session::valid_key("dGhlIHNhbXBsZSBub25jZQ=x"));
+    CHECK(!websocket_session::valid_key("dGhlIHNhbXBsZSBub25j!Q=="));
+    CHECK(!websocket_session::valid_key("c2FtcGxlIG5vbmNlIHNhbXBsZQ=="));
+    CHECK(!websocket_session::valid_key(""));
+
+    /*RFC 6455 5.7中的帧：服务器发出的帧不加掩码，126和127表示16位和64位的长度*/
+    {
+        websocket_frame* frame = websocket_frame::create(websocket_session::OP_TEXT, "Hello", 5);
+        CHECK(std::string(frame->data(), frame->size()) == std::string("\x81\x05Hello", 7));
+        frame->release();
+        std::string payload(256, 'x');
+        frame = websocket_frame::create(websocket_session::OP_BINARY, payload.data(), payload.size());
+        CHECK(frame->size() == 4 + 256 && memcmp(frame->data(), "\x82\x7e\x01\x00", 4) == 0);
+        frame->release();
+        payload.assign(65536, 'x');
+        frame = websocket_frame::create(websocket_session::OP_BINARY, payload.data(), payload.size());
+        CHECK(frame->size() == 10 + 65536 && memcmp(frame->data(), "\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10) == 0);
+        frame->release();
+    }
+
+    /*掩码按4字节循环，长度不是4或16的倍数时尾部也要处理*/
+    {
+        const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+        char data[] = "\x7f\x9f\x4d\x51\x58";
+        websocket_session::unmask(data, 5, key);
+        CHECK(memcmp(data, "Hello", 5) == 0);
+        std::string text(1000, 'x');
+        std::string masked = text;
+        for(size_t i = 0; i < masked.size(); i ++){
+            masked[i] ^= key[i % 4];
+        }
+        websocket_session::unmask(&masked[0], masked.size(), key);
+        CHECK(masked == text);
+    }
+
+    /*UTF-8*/
+    CHECK(UTF8(""));
+    CHECK(UTF8("Hello-\xc2\xb5@\xc3\x9f\xc3\xb6\xc3\xa4\xc3\xbc\xc3\xa0\xc3\xa1-UTF-8!!"));
+    CHECK(UTF8("\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5"));
+    CHECK(UTF8("\xed\x9f\xbf\xee\x80\x80\xef\xbf\xbd\xf4\x8f\xbf\xbf\xf0\x90\x80\x80"));
+    CHECK(UTF8("0123456789abcdef0123456789abcdef\xe2\x82\xac"));
+    /*超长编码、代理对、大于U+10FFFF的码点、单独的后续字节以及不完整的字符*/
+    CHECK(!UTF8("\xc0\xaf"));
+    CHECK(!UTF8("\xe0\x80\xaf"));
+    CHECK(!UTF8("\xf0\x80\x80\xaf"));
+    CHECK(!UTF8("\xed\xa0\x80"));
+    CHECK(!UTF8("\xf4\x90\x80\x80"));
+    CHECK(!UTF8("\xf5\x80\x80\x80"));
+    CHECK(!UTF8("\x80"));
+    CHECK(!UTF8("0123456789abcdef\xff"));
+    CHECK(!UTF8("\xce\xba\xe1\xbd"));
+    /*字符被分片截断时state跨分片保留*/
+    {
+        const char* text = "\xce\xba\xe1\xbd\xb9\xf0\x9f\x98\x80";
+        size_t len = strlen(text);
+        for(size_t cut = 0; cut <= len; cut ++){
+            uint32_t state = 0;
+            bool ok = websocket_session::utf8_check((const uint8_t*)text, cut, &state) &&
+                      websocket_session::utf8_check((const uint8_t*)text + cut, len - cut, &state);
+            CHECK(ok && state == 0);
+        }
+        uint32_t state = 0;
+        CHECK(websocket_session::utf8_check((const uint8_t*)"\xe1\xbd", 2, &state) && state != 0);
+        CHECK(!websocket_session::utf8_check((const uint8_t*)"A", 1, &state));
+    }
+
+    /*关闭帧的状态码*/
+    CHECK(websocket_session::valid_close_code(1000));
+    CHECK(websocket_session::valid_close_code(1003));
+    CHECK(websocket_session::valid_close_code(1007));
+    CHECK(websocket_session::valid_close_code(1014));
+    CHECK(websocket_session::valid_close_code(3000));
+    CHECK(websocket_session::valid_close_code(4999));
+    CHECK(!websocket_session::valid_close_code(0));
+    CHECK(!websocket_session::valid_close_code(999));
+    CHECK(!websocket_session::valid_close_code(1004));
+    CHECK(!websocket_session::valid_close_code(1005));
+    CHECK(!websocket_session::valid_close_code(1006));
+    CHECK(!websocket_session::valid_close_code(1015));
+    CHECK(!websocket_session::valid_close_code(2999));
+    CHECK(!websocket_session::valid_close_code(5000));
+    return check_result();
+}
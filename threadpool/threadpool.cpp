@@ -2,74 +2,419 @@
 
 template< typename T >
 threadpool< T >::threadpool(int thread_number, int max_requests):
-m_thread_number(thread_number), m_max_requests(max_requests), m_stop(false), m_threads(NULL){
+m_thread_number(0), m_max_requests(max_requests), m_class_count(1), m_drr_class(0), m_queued(0),
+m_stop(false), m_retire(0),
+m_adaptive(false), m_min_threads(thread_number), m_max_threads(thread_number), m_target_wait_us(0),
+m_wait_samples(0), m_busy_us(0), m_grow_votes(0), m_shrink_votes(0){
     /*如果线程池容纳大小或者队列内最大请求小于0，则抛出异常*/
     if((thread_number <= 0) || (max_requests <= 0)){
         throw std::exception();
     }
-    /*初始化线程池*/
-    m_threads = new pthread_t[m_thread_number];
-    
-    /*初始化失败则抛出异常*/
-    if(!m_threads){
-        throw std::exception();
+    for(int i = 0; i < WAIT_BUCKETS; i ++){
+        m_wait_hist[i] = 0;
+    }
+    for(int i = 0; i < MAX_CLASSES; i ++){
+        m_classes[i].weight = 1;
+        m_classes[i].deficit = 0;
+        m_classes[i].reserved = 0;
+        m_classes[i].idle_reserved = 0;
+        m_classes[i].wakeups = 0;
     }
-    /*创建thread_number个线程，并将他们设置为脱离线程*/
+    /*创建thread_number个线程，线程退出时由线程池负责回收*/
+    m_queuelocker.lock();
     for(int i = 0; i < thread_number; i ++){
-        /*如果创建线程失败，则删除所有线程*/
-        if(pthread_create(m_threads + 1, NULL, worker, this) != 0){
-            delete [] m_threads;
-            throw std::exception();
-        }
-        /*设置脱离线程其资源可以由系统自动进行回收*/
-        if(pthread_detach( m_threads[i] )){
-            delete [] m_threads;
+        /*如果创建线程失败，则结束已经创建的线程*/
+        if(!spawn_worker()){
+            m_stop = true;
+            m_queuecond.broadcast();
+            m_queuelocker.unlock();
+            reap();
             throw std::exception();
         }
     }
+    m_queuelocker.unlock();
 }
 
+/*先通知所有线程退出，再等待它们结束，最后才释放线程池的资源*/
 template< typename T >
 threadpool< T >::~threadpool(){
-    delete [] m_threads;
+    m_queuelocker.lock();
     m_stop = true;
+    bool adaptive = m_adaptive;
+    m_queuecond.broadcast();
+    for(int i = 0; i < MAX_CLASSES; i ++){
+        m_classes[i].reserved_cond.broadcast();
+    }
+    m_control_cond.signal();
+    m_queuelocker.unlock();
+    if(adaptive){
+        pthread_join(m_controller, NULL);
+    }
+    reap();
+}
+
+template< typename T >
+long long threadpool< T >::now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+template< typename T >
+bool threadpool< T >::spawn_worker(int cls){
+    worker_arg* arg = new worker_arg;
+    arg->pool = this;
+    arg->cls = cls;
+    pthread_t tid;
+    if(pthread_create(&tid, NULL, worker, arg) != 0){
+        delete arg;
+        return false;
+    }
+    m_threads.push_back(tid);
+    if(cls < 0){
+        m_thread_number ++;
+    }
+    else{
+        m_classes[cls].reserved ++;
+    }
+    return true;
+}
+
+template< typename T >
+void threadpool< T >::reap(){
+    while(true){
+        m_queuelocker.lock();
+        std::list< pthread_t > exited;
+        exited.swap(m_exited);
+        bool done = m_threads.empty();
+        m_queuelocker.unlock();
+        for(typename std::list< pthread_t >::iterator it = exited.begin(); it != exited.end(); ++ it){
+            pthread_join(*it, NULL);
+        }
+        /*只有析构时才需要等待所有线程退出*/
+        if(done || !m_stop){
+            break;
+        }
+        if(exited.empty()){
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, NULL);
+        }
+    }
 }
 
 /*给请求队列添加任务*/
-template< typename T > 
-bool threadpool< T >::append(T* request){
+template< typename T >
+bool threadpool< T >::append(T* request, int cls){
+    if(cls < 0 || cls >= MAX_CLASSES){
+        return false;
+    }
+    work_item item;
+    item.request = request;
+    item.enqueue_us = now_us();
     /*加锁避免多个线程同时访问*/
-    m_workqueue.lock();
-    if(m_workqueue.size() > m_max_requests){
-        m_workqueue.unlock();
+    m_queuelocker.lock();
+    work_class& c = m_classes[cls];
+    if((int)c.queue.size() >= m_max_requests){
+        m_queuelocker.unlock();
+        return false;
+    }
+    c.queue.push_back(item);
+    m_queued ++;
+    if(cls >= m_class_count){
+        m_class_count = cls + 1;
+    }
+    /*本类别有空闲的预留线程时交给它，否则唤醒一个普通工作线程*/
+    if(c.idle_reserved > 0){
+        c.idle_reserved --;
+        c.wakeups ++;
+        c.reserved_cond.signal();
+    }
+    else{
+        m_queuecond.signal();
+    }
+    m_queuelocker.unlock();
+    return true;
+}
+
+template< typename T >
+bool threadpool< T >::set_class(int cls, int weight, int reserved){
+    if(cls < 0 || cls >= MAX_CLASSES || weight <= 0 || reserved < 0){
+        return false;
+    }
+    m_queuelocker.lock();
+    work_class& c = m_classes[cls];
+    /*预留线程只增不减*/
+    if(m_stop || reserved < c.reserved){
+        m_queuelocker.unlock();
+        return false;
+    }
+    c.weight = weight;
+    if(cls >= m_class_count){
+        m_class_count = cls + 1;
+    }
+    bool ok = true;
+    while(ok && c.reserved < reserved){
+        ok = spawn_worker(cls);
+    }
+    m_queuelocker.unlock();
+    return ok;
+}
+
+template< typename T >
+bool threadpool< T >::set_adaptive(int min_threads, int max_threads, int target_wait_us){
+    if(min_threads <= 0 || max_threads < min_threads || target_wait_us <= 0){
+        return false;
+    }
+    m_queuelocker.lock();
+    if(m_stop){
+        m_queuelocker.unlock();
+        return false;
+    }
+    m_min_threads = min_threads;
+    m_max_threads = max_threads;
+    m_target_wait_us = target_wait_us;
+    /*当前线程数不在新的范围内时立即调整*/
+    while(m_thread_number < m_min_threads && spawn_worker()){
+    }
+    int retire = m_thread_number - m_retire - m_max_threads;
+    if(retire > 0){
+        m_retire += retire;
+        m_queuecond.broadcast();
+    }
+    bool start = !m_adaptive;
+    m_adaptive = true;
+    m_queuelocker.unlock();
+    if(start && pthread_create(&m_controller, NULL, controller, this) != 0){
+        m_queuelocker.lock();
+        m_adaptive = false;
+        m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(request);
-    m_workqueue.unlock();
-    m_queuestat.post();
     return true;
 }
+
 template< typename T >
 void* threadpool< T >::worker(void* arg){
+    worker_arg* warg = (worker_arg*) arg;
+    threadpool* pool = warg->pool;
+    int cls = warg->cls;
+    delete warg;
+    pool -> run(cls);
+    return pool;
+}
+
+template< typename T >
+void* threadpool< T >::controller(void* arg){
     threadpool* pool = (threadpool*) arg;
-    pool -> run();
+    pool -> control();
     return pool;
 }
 
+/*从类别cls的队首取出一个请求，并记录排队时间*/
+template< typename T >
+typename threadpool< T >::work_item threadpool< T >::take(int cls){
+    work_item item = m_classes[cls].queue.front();
+    m_classes[cls].queue.pop_front();
+    m_queued --;
+    long long wait = now_us() - item.enqueue_us;
+    int bucket = 0;
+    while(bucket < WAIT_BUCKETS - 1 && (wait >> (bucket + 1)) > 0){
+        bucket ++;
+    }
+    m_wait_hist[bucket] ++;
+    m_wait_samples ++;
+    return item;
+}
 
+/*差额轮询：当前类别额度用完或者队列为空时轮到下一个类别，并给它加上一份权重的额度*/
 template< typename T >
-void threadpool< T >::run(){
-    while(!m_stop){
-        m_queuestat.wait();
+typename threadpool< T >::work_item threadpool< T >::pick(){
+    for(int n = 0; n <= 2 * m_class_count; n ++){
+        work_class& c = m_classes[m_drr_class];
+        if(!c.queue.empty() && c.deficit > 0){
+            c.deficit --;
+            return take(m_drr_class);
+        }
+        /*空队列不积攒额度*/
+        if(c.queue.empty()){
+            c.deficit = 0;
+        }
+        m_drr_class = (m_drr_class + 1) % m_class_count;
+        m_classes[m_drr_class].deficit += m_classes[m_drr_class].weight;
+    }
+    int cls = 0;
+    while(m_classes[cls].queue.empty()){
+        cls ++;
+    }
+    return take(cls);
+}
+
+template< typename T >
+void threadpool< T >::run(int cls){
+    m_queuelocker.lock();
+    while(true){
+        /*线程池结束或者需要缩容时退出，由回收者join*/
+        if(m_stop || (cls < 0 && m_retire > 0)){
+            break;
+        }
+        work_item item;
+        if(cls < 0){
+            /*普通工作线程按DRR处理所有类别的请求*/
+            if(m_queued == 0){
+                m_queuecond.wait(m_queuelocker.get());
+                continue;
+            }
+            item = pick();
+        }
+        else{
+            /*预留线程只处理本类别的请求*/
+            work_class& c = m_classes[cls];
+            if(c.queue.empty()){
+                c.idle_reserved ++;
+                while(c.wakeups == 0 && !m_stop){
+                    c.reserved_cond.wait(m_queuelocker.get());
+                }
+                if(m_stop){
+                    break;
+                }
+                c.wakeups --;
+                /*分给本线程的请求被普通工作线程取走了，把唤醒转交给普通工作线程*/
+                if(c.queue.empty()){
+                    if(m_queued > 0){
+                        m_queuecond.signal();
+                    }
+                    continue;
+                }
+            }
+            item = take(cls);
+        }
+        m_queuelocker.unlock();
+        if(item.request){
+            long long start = now_us();
+            item.request -> process();
+            m_busy_us.fetch_add(now_us() - start, std::memory_order_relaxed);
+        }
         m_queuelocker.lock();
-        if(m_workqueue.empty()){
-            m_workqueue.unlock();
+    }
+    if(cls < 0){
+        if(!m_stop){
+            m_retire --;
+        }
+        m_thread_number --;
+    }
+    else{
+        m_classes[cls].reserved --;
+    }
+    pthread_t self = pthread_self();
+    for(typename std::list< pthread_t >::iterator it = m_threads.begin(); it != m_threads.end(); ++ it){
+        if(pthread_equal(*it, self)){
+            m_threads.erase(it);
+            break;
+        }
+    }
+    m_exited.push_back(self);
+    m_queuelocker.unlock();
+}
+
+template< typename T >
+long long threadpool< T >::wait_percentile(double percentile){
+    if(m_wait_samples == 0){
+        return 0;
+    }
+    double need = m_wait_samples * percentile;
+    long long seen = 0;
+    for(int i = 0; i < WAIT_BUCKETS; i ++){
+        if(seen + m_wait_hist[i] >= need){
+            /*在桶内线性插值*/
+            long long low = i == 0 ? 0 : (1LL << i);
+            long long high = 1LL << (i + 1);
+            return low + (long long)((high - low) * (need - seen) / m_wait_hist[i]);
+        }
+        seen += m_wait_hist[i];
+    }
+    return 1LL << WAIT_BUCKETS;
+}
+
+/*控制线程：每个采样周期根据排队时间的p99和线程利用率决定是否扩容或缩容*/
+template< typename T >
+void threadpool< T >::control(){
+    long long last = now_us();
+    m_queuelocker.lock();
+    while(!m_stop){
+        struct timespec abstime;
+        clock_gettime(CLOCK_REALTIME, &abstime);
+        abstime.tv_nsec += SAMPLE_INTERVAL_MS * 1000000L;
+        abstime.tv_sec += abstime.tv_nsec / 1000000000L;
+        abstime.tv_nsec %= 1000000000L;
+        m_control_cond.timewait(m_queuelocker.get(), abstime);
+        if(m_stop){
+            break;
+        }
+        long long now = now_us();
+        long long elapsed = now - last;
+        if(elapsed < SAMPLE_INTERVAL_MS * 1000LL / 2){
             continue;
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
+        last = now;
+
+        long long p99 = wait_percentile(0.99);
+        /*工作线程全部阻塞在耗时的请求上时没有新的样本，因此也要看队首请求已经等了多久*/
+        long long oldest = 0;
+        for(int i = 0; i < m_class_count; i ++){
+            if(!m_classes[i].queue.empty() && now - m_classes[i].queue.front().enqueue_us > oldest){
+                oldest = now - m_classes[i].queue.front().enqueue_us;
+            }
+        }
+        int active = m_thread_number - m_retire;
+        double utilization = (double)m_busy_us.exchange(0, std::memory_order_relaxed) /
+                             ((double)elapsed * (active > 0 ? active : 1));
+        for(int i = 0; i < WAIT_BUCKETS; i ++){
+            m_wait_hist[i] = 0;
+        }
+        m_wait_samples = 0;
+
+        if(p99 > m_target_wait_us || oldest > m_target_wait_us){
+            m_grow_votes ++;
+            m_shrink_votes = 0;
+        }
+        else if(p99 < m_target_wait_us / 2 && utilization < 0.5){
+            m_shrink_votes ++;
+            m_grow_votes = 0;
+        }
+        else{
+            m_grow_votes = 0;
+            m_shrink_votes = 0;
+        }
+
+        if(m_grow_votes >= GROW_SAMPLES && active < m_max_threads){
+            /*每次扩容当前线程数的一半，至少一个*/
+            int grow = active / 2 > 1 ? active / 2 : 1;
+            if(grow > m_max_threads - active){
+                grow = m_max_threads - active;
+            }
+            /*优先取消尚未执行的缩容*/
+            while(grow > 0 && m_retire > 0){
+                m_retire --;
+                grow --;
+            }
+            while(grow > 0 && spawn_worker()){
+                grow --;
+            }
+            m_grow_votes = 0;
+        }
+        else if(m_shrink_votes >= SHRINK_SAMPLES && active > m_min_threads){
+            /*每次缩容当前线程数的1/8，至少一个*/
+            int retire = active / 8 > 1 ? active / 8 : 1;
+            if(retire > active - m_min_threads){
+                retire = active - m_min_threads;
+            }
+            m_retire += retire;
+            m_queuecond.broadcast();
+            m_shrink_votes = 0;
+        }
         m_queuelocker.unlock();
-        if(!request) continue;
-        request -> process();
+        reap();
+        m_queuelocker.lock();
     }
-}
\ No newline at end of file
+    m_queuelocker.unlock();
+}
@@ -4,37 +4,121 @@
 #include <list>
 #include <cstdio>
 #include <exception>
+#include <atomic>
 #include <pthread.h>
+#include <time.h>
 
 #include "locker.h"
 
 template< typename T >
 class threadpool{
+public:
+    /*最多支持的优先级(代价)类别数*/
+    static const int MAX_CLASSES = 8;
+
 public:
     /*thread_number是线程池中线程的数量，max_requests是请求队列中最多允许存在里请求*/
     threadpool(int thread_number = 8, int max_requests = 10000);
     ~threadpool();
-    /*往请求队列中添加任务*/
-    bool append(T* requests);
+    /*往类别cls的请求队列中添加任务，每个类别的队列最多容纳max_requests个请求*/
+    bool append(T* requests, int cls = 0);
+    /*设置类别cls的权重和预留线程数。各类别的队列按权重进行差额轮询(DRR)出队，
+      权重为w的类别每轮最多连续出队w个请求；reserved个预留线程只处理该类别的请求*/
+    bool set_class(int cls, int weight, int reserved = 0);
+    /*开启自适应模式：控制线程周期性地采样排队时间和线程利用率，
+      在[min_threads, max_threads]之间增减工作线程，使排队时间的p99不超过target_wait_us微秒*/
+    bool set_adaptive(int min_threads, int max_threads, int target_wait_us = 1000);
+
 private:
+    /*请求队列中的任务及其入队时间*/
+    struct work_item{
+        T* request;
+        long long enqueue_us;
+    };
+    /*一个类别的请求队列及调度信息*/
+    struct work_class{
+        std::list< work_item > queue;
+        //DRR的权重和当前剩余额度
+        int weight;
+        int deficit;
+        //预留线程总数及其中空闲的数量
+        int reserved;
+        int idle_reserved;
+        //已分配给预留线程但还未被其领取的唤醒次数
+        int wakeups;
+        //预留线程在此等待本类别的请求
+        cond reserved_cond;
+    };
+    /*传给线程函数的参数，cls为-1表示普通工作线程*/
+    struct worker_arg{
+        threadpool* pool;
+        int cls;
+    };
     static void* worker(void* arg);
-    void run();
+    static void* controller(void* arg);
+    void run(int cls);
+    void control();
+    /*创建一个工作线程，调用时必须持有m_queuelocker*/
+    bool spawn_worker(int cls = -1);
+    /*回收已经退出的工作线程*/
+    void reap();
+    /*按DRR从各类别中取出一个请求，调用时必须持有m_queuelocker且m_queued > 0*/
+    work_item pick();
+    /*从类别cls中取出一个请求并记录排队时间，调用时必须持有m_queuelocker*/
+    work_item take(int cls);
+    /*根据排队时间直方图估算p99，调用时必须持有m_queuelocker*/
+    long long wait_percentile(double percentile);
+    static long long now_us();
 
 private:
-    //线程池中的线程数
+    /*采样周期(毫秒)*/
+    static const int SAMPLE_INTERVAL_MS = 100;
+    /*连续多少个周期超出目标才扩容，连续多少个周期空闲才缩容：扩容快、缩容慢，避免来回抖动*/
+    static const int GROW_SAMPLES = 2;
+    static const int SHRINK_SAMPLES = 10;
+    /*排队时间直方图的桶数，第i个桶统计[2^i, 2^(i+1))微秒的排队时间*/
+    static const int WAIT_BUCKETS = 32;
+
+    //线程池中普通工作线程的数量，不含预留线程
     int m_thread_number;
-    //请求队列中的最大请求数
+    //每个类别的请求队列中的最大请求数
     int m_max_requests;
-    //线程池，描述线程池的数组
-    pthread_t* m_threads;
-    //请求队列
-    std::list< T* > m_workqueue;
+    //线程池，正在运行的线程
+    std::list< pthread_t > m_threads;
+    //已经退出、等待回收的线程
+    std::list< pthread_t > m_exited;
+    //各类别的请求队列
+    work_class m_classes[MAX_CLASSES];
+    int m_class_count;
+    //DRR当前轮到的类别
+    int m_drr_class;
+    //所有队列中的请求总数
+    int m_queued;
     //保护请求队列的互斥锁
     locker m_queuelocker;
-    sem m_queuestat;
+    //普通工作线程在此等待请求
+    cond m_queuecond;
     //是否结束线程
     bool m_stop;
+    //还需要退出的线程数，缩容时由控制线程设置
+    int m_retire;
+
+    /*自适应模式的相关信息*/
+    bool m_adaptive;
+    int m_min_threads;
+    int m_max_threads;
+    int m_target_wait_us;
+    pthread_t m_controller;
+    //用于在析构时唤醒控制线程
+    cond m_control_cond;
+    //本周期内的排队时间直方图及样本数
+    long long m_wait_hist[WAIT_BUCKETS];
+    long long m_wait_samples;
+    //本周期内工作线程处理请求的总时间
+    std::atomic< long long > m_busy_us;
+    int m_grow_votes;
+    int m_shrink_votes;
 };
 
 
-#endif
\ No newline at end of file
+#endif
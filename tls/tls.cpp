@@ -0,0 +1,246 @@
+#include "tls.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WITH_TLS
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+/*会话缓存的ID上下文，同一服务器的所有进程必须一致*/
+static const unsigned char session_id_context[] = "my_webserver";
+
+static void print_errors(const char* what){
+    unsigned long err = ERR_get_error();
+    char buf[256];
+    ERR_error_string_n(err, buf, sizeof(buf));
+    fprintf(stderr, "tls: %s: %s\n", what, err ? buf : "unknown error");
+    ERR_clear_error();
+}
+
+/*ALPN：客户端提供h2时选择h2，连接随后以HTTP/2连接前言开始，由http_conn按prior knowledge处理*/
+static int select_alpn(SSL* /*ssl*/, const unsigned char** out, unsigned char* outlen,
+                       const unsigned char* in, unsigned int inlen, void* /*arg*/){
+    static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+    if(SSL_select_next_proto((unsigned char**)out, outlen, protocols, sizeof(protocols) - 1, in, inlen)
+       != OPENSSL_NPN_NEGOTIATED){
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+tls_context::tls_context(): m_ctx(0){
+}
+
+tls_context::~tls_context(){
+    if(m_ctx){
+        SSL_CTX_free(m_ctx);
+    }
+}
+
+bool tls_context::init(const char* cert_file, const char* key_file, const char* ticket_key_file){
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if(!m_ctx){
+        print_errors("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+    /*只使用内核kTLS支持的AEAD算法，否则握手后无法把密钥交给内核*/
+    SSL_CTX_set_cipher_list(m_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION |
+                        SSL_OP_IGNORE_UNEXPECTED_EOF);
+    /*退回到SSL_write时，重试的缓冲区地址可能变化(HTTP/2的发送队列)，并且允许只写出一部分*/
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_RELEASE_BUFFERS);
+    if(SSL_CTX_use_certificate_chain_file(m_ctx, cert_file) != 1){
+        print_errors(cert_file);
+        return false;
+    }
+    if(SSL_CTX_use_PrivateKey_file(m_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(m_ctx) != 1){
+        print_errors(key_file);
+        return false;
+    }
+    /*会话恢复：TLS 1.2的会话ID缓存，以及TLS 1.2/1.3的会话票据。
+      恢复的会话跳过证书签名和密钥交换中代价最高的部分*/
+    SSL_CTX_set_session_id_context(m_ctx, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(m_ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_num_tickets(m_ctx, 1);
+    if(ticket_key_file){
+        unsigned char keys[TICKET_KEY_LEN];
+        FILE* fp = fopen(ticket_key_file, "rb");
+        size_t n = fp ? fread(keys, 1, sizeof(keys), fp) : 0;
+        if(fp){
+            fclose(fp);
+        }
+        if(n != sizeof(keys) || SSL_CTX_set_tlsext_ticket_keys(m_ctx, keys, sizeof(keys)) != 1){
+            fprintf(stderr, "tls: cannot load %d-byte ticket key from %s\n", TICKET_KEY_LEN, ticket_key_file);
+            return false;
+        }
+        memset(keys, 0, sizeof(keys));
+    }
+    SSL_CTX_set_alpn_select_cb(m_ctx, select_alpn, NULL);
+    return true;
+}
+
+bool tls_conn::attach(tls_context* ctx, int sockfd){
+    close();
+    m_ssl = SSL_new(ctx->get());
+    if(!m_ssl || SSL_set_fd(m_ssl, sockfd) != 1){
+        print_errors("SSL_new");
+        close();
+        return false;
+    }
+    SSL_set_accept_state(m_ssl);
+    return true;
+}
+
+void tls_conn::close(){
+    if(m_ssl){
+        SSL_free(m_ssl);
+        m_ssl = 0;
+    }
+    m_established = false;
+    m_ktls_send = false;
+    m_want_write = false;
+}
+
+bool tls_conn::resumed() const{
+    return m_ssl && SSL_session_reused(m_ssl);
+}
+
+tls_conn::HANDSHAKE_RESULT tls_conn::handshake(){
+    int ret = SSL_do_handshake(m_ssl);
+    m_want_write = false;
+    if(ret == 1){
+        m_established = true;
+        /*OpenSSL在握手完成后自行尝试启用kTLS，这里只查询结果*/
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        return HANDSHAKE_DONE;
+    }
+    switch(SSL_get_error(m_ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ:
+            return HANDSHAKE_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            m_want_write = true;
+            return HANDSHAKE_WANT_WRITE;
+        default:
+            ERR_clear_error();
+            return HANDSHAKE_ERROR;
+    }
+}
+
+ssize_t tls_conn::read(char* buf, size_t len){
+    int ret = SSL_read(m_ssl, buf, len);
+    if(ret > 0){
+        return ret;
+    }
+    return fail(ret);
+}
+
+ssize_t tls_conn::writev(int sockfd, const struct iovec* iov, int count){
+    /*内核负责加密，直接把文件内容交给内核*/
+    if(m_ktls_send){
+        return ::writev(sockfd, iov, count);
+    }
+    /*跳过已经发完的缓冲区*/
+    while(count > 0 && iov->iov_len == 0){
+        iov ++;
+        count --;
+    }
+    if(count == 0){
+        return 0;
+    }
+    /*大块数据直接加密；小块数据(响应头、HTTP/2帧头)合并后再加密，避免产生大量很小的记录。
+      重试时iovec的开头不变，合并出的数据只会与上次相同或者更长，满足SSL_write重试的要求*/
+    if(iov->iov_len >= (size_t)STAGE_SIZE || count == 1){
+        return ssl_write((const char*)iov->iov_base, iov->iov_len);
+    }
+    char stage[STAGE_SIZE];
+    size_t len = 0;
+    for(int i = 0; i < count && len < sizeof(stage); i ++){
+        size_t n = iov[i].iov_len;
+        if(n > sizeof(stage) - len){
+            n = sizeof(stage) - len;
+        }
+        memcpy(stage + len, iov[i].iov_base, n);
+        len += n;
+    }
+    return ssl_write(stage, len);
+}
+
+ssize_t tls_conn::ssl_write(const char* buf, size_t len){
+    int ret = SSL_write(m_ssl, buf, len);
+    if(ret > 0){
+        return ret;
+    }
+    return fail(ret);
+}
+
+ssize_t tls_conn::fail(int ret){
+    switch(SSL_get_error(m_ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            /*errno由失败的系统调用设置*/
+            ERR_clear_error();
+            return -1;
+        default:
+            ERR_clear_error();
+            errno = EIO;
+            return -1;
+    }
+}
+
+#else
+
+tls_context::tls_context(): m_ctx(0){
+}
+
+tls_context::~tls_context(){
+}
+
+bool tls_context::init(const char* /*cert_file*/, const char* /*key_file*/, const char* /*ticket_key_file*/){
+    fprintf(stderr, "tls: built without OpenSSL (WITH_TLS=OFF)\n");
+    return false;
+}
+
+bool tls_conn::attach(tls_context* /*ctx*/, int /*sockfd*/){
+    return false;
+}
+
+void tls_conn::close(){
+    m_ssl = 0;
+    m_established = false;
+    m_ktls_send = false;
+    m_want_write = false;
+}
+
+bool tls_conn::resumed() const{
+    return false;
+}
+
+tls_conn::HANDSHAKE_RESULT tls_conn::handshake(){
+    return HANDSHAKE_ERROR;
+}
+
+ssize_t tls_conn::read(char* /*buf*/, size_t /*len*/){
+    errno = EIO;
+    return -1;
+}
+
+ssize_t tls_conn::writev(int /*sockfd*/, const struct iovec* /*iov*/, int /*count*/){
+    errno = EIO;
+    return -1;
+}
+
+#endif
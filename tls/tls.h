@@ -0,0 +1,80 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*OpenSSL的类型，避免在头文件中引入OpenSSL*/
+struct ssl_st;
+struct ssl_ctx_st;
+
+/*TLS只在握手时使用OpenSSL：握手完成后OpenSSL通过setsockopt(TCP_ULP, "tls")把会话密钥交给内核(kTLS)，
+  之后响应仍然直接writev到socket，由内核加密，保留mmap+writev的零拷贝发送。
+  内核不支持kTLS时退回到SSL_write。编译时没有OpenSSL(WITH_TLS=OFF)时init总是失败*/
+
+/*服务器的TLS配置，所有连接共享一个*/
+class tls_context{
+public:
+    /*服务器会话缓存的大小*/
+    static const long SESSION_CACHE_SIZE = 20480;
+    /*会话票据密钥文件的长度：名字16字节、HMAC密钥32字节、AES密钥32字节*/
+    static const int TICKET_KEY_LEN = 80;
+
+public:
+    tls_context();
+    ~tls_context();
+    /*加载证书链和私钥；ticket_key_file不为NULL时从中读取票据密钥，
+      使多个进程或者重启后的进程能够恢复彼此签发的会话，否则使用随机生成的密钥*/
+    bool init(const char* cert_file, const char* key_file, const char* ticket_key_file = NULL);
+    struct ssl_ctx_st* get(){ return m_ctx; }
+
+private:
+    struct ssl_ctx_st* m_ctx;
+};
+
+/*一个连接的TLS状态，所有操作都是非阻塞的*/
+class tls_conn{
+public:
+    /*握手的结果*/
+    enum HANDSHAKE_RESULT{HANDSHAKE_ERROR = -1, HANDSHAKE_DONE = 0,
+                          HANDSHAKE_WANT_READ, HANDSHAKE_WANT_WRITE};
+    /*回退到SSL_write时把小块数据合并到一个记录中的缓冲区大小(一个TLS记录的最大明文长度)*/
+    static const int STAGE_SIZE = 16384;
+
+public:
+    tls_conn(): m_ssl(0), m_established(false), m_ktls_send(false), m_want_write(false){}
+    ~tls_conn(){ close(); }
+    /*为新连接创建TLS状态，之后需要调用handshake直到完成*/
+    bool attach(tls_context* ctx, int sockfd);
+    /*释放TLS状态，不发送close_notify*/
+    void close();
+    /*是否启用了TLS*/
+    bool active() const { return m_ssl != 0; }
+    /*握手是否已经完成*/
+    bool established() const { return m_established; }
+    /*发送方向是否由内核加密，此时可以直接writev到socket*/
+    bool ktls_send() const { return m_ktls_send; }
+    /*握手是否在等待socket可写*/
+    bool want_write() const { return m_want_write; }
+    /*是否恢复了之前的会话*/
+    bool resumed() const;
+    /*继续握手*/
+    HANDSHAKE_RESULT handshake();
+    /*与recv/writev的约定相同：出错返回-1并设置errno，数据暂时不可读写时errno为EAGAIN，对方关闭时读返回0*/
+    ssize_t read(char* buf, size_t len);
+    ssize_t writev(int sockfd, const struct iovec* iov, int count);
+
+private:
+    ssize_t ssl_write(const char* buf, size_t len);
+    /*把SSL_get_error的结果转换为errno*/
+    ssize_t fail(int ret);
+
+private:
+    struct ssl_st* m_ssl;
+    bool m_established;
+    bool m_ktls_send;
+    bool m_want_write;
+};
+
+#endif